@@ -1,4 +1,4 @@
-import os, socket, sys
+import os, socket, struct, sys
 import cmd, json
 import logging, traceback
 
@@ -6,6 +6,26 @@ logger = logging.getLogger()
 logger.addHandler(logging.StreamHandler(sys.stdout))
 logger.setLevel(os.getenv('LOG_LEVEL',logging.INFO))
 
+def send_frame(sock, obj):
+    ''' Sends the object as a length prefixed frame. '''
+    body = obj.encode()
+    sock.sendall(struct.pack('!I', len(body)) + body)
+
+def recv_exact(sock, n):
+    ''' Receives exactly n bytes from the socket. '''
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError('connection closed by pyoneer')
+        data += chunk
+    return data
+
+def recv_frame(sock):
+    ''' Receives a length prefixed frame and returns its body. '''
+    n, = struct.unpack('!I', recv_exact(sock, 4))
+    return recv_exact(sock, n)
+
 class PyoneerShell(cmd.Cmd):
     intro = 'Welcome to the worker shell. Type help or ? to list commands.\n'
     prompt = '(worker) '
@@ -27,7 +47,7 @@ class PyoneerShell(cmd.Cmd):
             return line
 
         tokens = line.split()
-        if (tokens[0] in ['get_status','get_job_status','run','start','stop']):
+        if (tokens[0] in ['get_status','get_job_status','run','start','stop','watch']):
             # Connect to worker
             self.sock = socket.socket(socket.AF_UNIX)
             try:
@@ -63,8 +83,8 @@ class PyoneerShell(cmd.Cmd):
     def do_get_status(self, id):
         ''' Gets the worker status. '''
         obj = json.dumps({'command': 'get_status'})
-        self.sock.send(obj.encode())
-        res = self.sock.recv(1024)
+        send_frame(self.sock, obj)
+        res = recv_frame(self.sock)
         obj = json.loads(res)
         logger.info(f'status: {obj['status']}')
         if (obj.get('debug')):
@@ -73,8 +93,8 @@ class PyoneerShell(cmd.Cmd):
     def do_get_job_status(self, id):
         ''' Gets the job status '''
         obj = json.dumps({'command': 'get_job_status'})
-        self.sock.send(obj.encode())
-        res = self.sock.recv(1024)
+        send_frame(self.sock, obj)
+        res = recv_frame(self.sock)
         obj = json.loads(res)
         logger.info(f'job_status: {obj['job_status']}')
         if (obj.get('debug')):
@@ -89,24 +109,38 @@ class PyoneerShell(cmd.Cmd):
             'tasks': [task for task in tokens[2:]]
         }
         obj = json.dumps(obj)
-        self.sock.send(obj.encode())
-        res = self.sock.recv(1024)
+        send_frame(self.sock, obj)
+        res = recv_frame(self.sock)
         logger.info(res.decode())
 
     def do_start(self, id):
         ''' Starts the job. '''
         obj = json.dumps({'command': 'start'})
-        self.sock.send(obj.encode())
-        res = self.sock.recv(1024)
+        send_frame(self.sock, obj)
+        res = recv_frame(self.sock)
         logger.info(res.decode())
 
     def do_stop(self, id):
         ''' Stop the job. '''
         obj = json.dumps({'command': 'stop'})
-        self.sock.send(obj.encode())
-        res = self.sock.recv(1024)
+        send_frame(self.sock, obj)
+        res = recv_frame(self.sock)
         logger.info(res.decode())
 
+    def do_watch(self, line:str):
+        ''' Prints the statuses whenever they change, until interrupted. '''
+        obj = {'command': 'watch'}
+        tokens = line.split()
+        if (len(tokens) > 1):
+            obj['interval'] = int(tokens[1])
+        send_frame(self.sock, json.dumps(obj))
+        try:
+            while True:
+                res = recv_frame(self.sock)
+                logger.info(res.decode())
+        except KeyboardInterrupt:
+            pass
+
     def do_quit(self, line):
         ''' Quits the commandline interface. '''
         logger.info('Quitting Time!')
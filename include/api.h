@@ -15,8 +15,18 @@ typedef enum {
     API_UNASSIGN,
     API_START,
     API_STOP,
+    API_BATCH,
+    API_WATCH,
+    API_GET_METRICS,
+    API_GET_SNAPSHOT,
     API_WORKING,
-    API_NOT_WORKING
+    API_NOT_WORKING,
+    API_URING_FALLBACK,
+    API_SERVER_DRAIN,
+    API_DRAIN_TIMEOUT,
+    API_HANDOFF,
+    API_INHERIT,
+    API_NCODES
 } ApiCode;
 
 typedef enum {
@@ -29,14 +39,37 @@ typedef enum {
     API_ERR_SIGNAL,
     API_ERR_JSON_PARSE,
     API_ERR_JSON_TYPE,
-    API_ERR_JSON_MISSING
+    API_ERR_JSON_MISSING,
+    API_ERR_FRAME,
+    API_ERR_BUSY,
+    API_ERR_THROTTLED
 } ApiErrorCode;
 
+// Socket I/O backends
+typedef enum {
+    API_BACKEND_EPOLL,
+    API_BACKEND_URING
+} ApiBackend;
+
+// Command classes, each with its own rate limit per connection
+typedef enum {
+    API_CLASS_READ,
+    API_CLASS_CONTROL,     // commands that change the pyoneer
+    API_NCLASSES
+} ApiClass;
+
 typedef struct _api Api;
 
 Api* api_create(Pyoneer* pyoneer, Logger* logger, const char* path);
 void api_destroy(Api* server);
 
+int api_set_tcp(Api* server, const char* addr);
+int api_set_listeners(Api* server, int n);
+int api_set_drain_timeout(Api* server, long ms);
+int api_set_handoff(Api* server, const char* path);
+int api_set_rate_limit(Api* server, ApiClass cls, double rate, double burst);
+void api_set_backend(Api* server, ApiBackend backend);
+
 int api_start(Api* server);
 int api_stop(Api* server);
 
@@ -0,0 +1,36 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_MAXKEEP (1024*1024)
+
+// arena block
+typedef struct _arena_block {
+    struct _arena_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block;
+
+// Arena, a bump allocator that frees everything at once on reset
+typedef struct _arena {
+    arena_block* head;
+    size_t block_size;
+    size_t total;       // bytes allocated since the last reset
+} Arena;
+
+Arena* arena_create(size_t block_size);
+void arena_destroy(Arena* arena);
+
+// Methods
+void* arena_alloc(Arena* arena, size_t size, int zero);
+void* arena_realloc(Arena* arena, void* ptr, size_t size);
+void arena_reset(Arena* arena);
+
+// json-parser and json-builder allocator callbacks, user_data is the arena
+void* arena_mem_alloc(size_t size, int zero, void* user_data);
+void* arena_mem_realloc(void* ptr, size_t size, void* user_data);
+void arena_mem_free(void* ptr, void* user_data);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#include <stddef.h>
+
+// Growable byte buffer. The byte after the last byte in the buffer is
+// always addressable, so the contents can be terminated in place.
+typedef struct _buffer {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+Buffer* buffer_create(size_t capacity);
+void buffer_destroy(Buffer* buffer);
+
+// Methods
+int buffer_reserve(Buffer* buffer, size_t len);
+int buffer_append(Buffer* buffer, const char* data, size_t len);
+void buffer_consume(Buffer* buffer, size_t len);
+void buffer_clear(Buffer* buffer);
+void buffer_release(Buffer* buffer);
+
+#endif
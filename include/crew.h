@@ -2,50 +2,109 @@
 #define _CREW_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "buffer.h"
 #include "json.h"
 #include "json-builder.h"
 #include "worker.h"
 #include "job.h"
+#include "net.h"
+#include "idmap.h"
 
-#define CREW_MAXLEN 512
+#define CREW_MINCAP 64      // initial length of the worker arrays, a multiple of 64
+#define CREW_CLASSES 32     // worker classes, one bit each of a class mask
+#define CREW_BACKOFF_MAX 30000  // ms between reconnects to a down worker
+#define CREW_CALL_TIMEOUT 5000  // ms a command waits to connect, send or receive
+#define CREW_POLL_INTERVAL 10000    // ms between probes of a working worker
+#define CREW_POLL_IDLE_INTERVAL 30000   // ms between probes of an unassigned worker
+#define CREW_POLL_NEAR_INTERVAL 1000    // ms between probes of a job about to end
+#define CREW_POLL_NEAR 80       // percent of the mean job time when a job is about to end
+#define CREW_POLL_RETRY 1000    // ms between poll connection attempts
+#define CREW_POLL_TICK 100      // ms between poller scans for due workers
+#define CREW_POLL_EVENTS 64
+#define CREW_BROADCAST_TIMEOUT 1000 // ms for a broadcast to reach all workers
+#define CREW_BROADCAST_RETRY 10 // ms between tries for a connection in use
+#define CREW_PHI_SUSPECT 3.0    // phi at which a worker is suspect
+#define CREW_PHI_DEAD 8.0       // phi at which a worker is dead
+#define CREW_PHI_PAUSE 1000     // ms of answer delay tolerated on top of the mean
+#define CREW_PHI_MIN_STDDEV 500 // ms, floor of the answer delay deviation
+#define CREW_ASSIGN_GRACE 1000  // ms a worker may still report its state from before a job
 
-// job structure
-typedef struct _crew_job {
-    int id;
-    int status;
-} crew_job;
+// Worker health, from the failure detector
+enum {
+    CREW_ALIVE,
+    CREW_SUSPECT,       // late to answer, not assigned new jobs
+    CREW_DEAD           // its running job was handed back to the manager
+};
+
+// status watch connection, driven by the crew's poller thread
+typedef struct _crew_poll {
+    int fd;             // -1 while closed
+    int state;
+    int pending;        // set while a liveness probe is unanswered
+    long next;          // time of the next reconnect, or connect timeout (ms)
+    long last;          // time of the last message or probe (ms)
+    long sent;          // time the pending probe was sent (ms)
+    long owed;          // time since an answer is owed, -1 if none (ms)
+    double mean;        // moving mean of the answer delays, -1 before one (ms)
+    double var;         // moving variance of the answer delays
+    long version;       // state version of the last snapshot, -1 before one
+    Buffer* in;
+    Buffer* out;
+} crew_poll;
 
 // worker structure
 typedef struct {
     int id;
-    int status;
-    crew_job job;
+    int index;          // in the crew's arrays, guarded by the crew lock
+    net_addr addr;      // resolved once, when the worker is added
+    int fd;             // persistent connection, -1 while down
+    pthread_mutex_t conn;   // serializes commands on the connection
+    atomic_int refs;    // the crew's, plus one per caller talking to it
+    int failures;       // consecutive failed commands, 0 while healthy
+    long retry_at;      // no reconnects before this time (ms)
+    crew_poll poll;     // guarded by the crew lock
 } crew_worker;
 
-// crew node
-typedef struct _crew_node {
-    crew_worker* worker;
-    struct _crew_node* next;
-    struct _crew_node* prev;
-    struct _crew_node* next_free;
-    struct _crew_node* prev_free;
-    pthread_t tid;
-} crew_node;
-
-// crew list
-typedef struct _crew_list {
-    crew_node* head;
-    crew_node* tail;
-    int len;
-} crew_list;
+// broadcast result of one worker
+typedef struct _crew_result {
+    int id;
+    int busy;               // set if its connection stayed in use, nothing was sent
+    json_value* response;   // NULL if the worker failed or missed the deadline
+} crew_result;
 
-// Crew object
+// Crew object. Workers are kept in dense arrays, with the state the crew
+// reads on every scan stored apart from the connections. A hash table maps
+// each worker id to its index, and a removed worker's index is filled by
+// the last worker. Idle workers, and the workers of each class, are
+// bitsets over the indices, so finding an idle worker of some classes
+// takes a few word operations per 64 workers.
 typedef struct _crew {
-    crew_list workers[CREW_MAXLEN];
-    crew_list freelist;
+    IdMap* index;       // worker id -> index
     int len;
+    int capacity;       // of the arrays
+    int* ids;
+    int* status;        // worker statuses
+    int* job_ids;
+    int* job_status;
+    long* job_start;    // time each job was assigned, 0 if none (ms)
+    int* health;
+    unsigned int* classes;  // class masks
+    crew_worker** workers;
+    uint64_t* idle;     // idle workers, unassigned
+    uint64_t* down;     // suspect or dead workers, not assigned jobs
+    uint64_t* members[CREW_CLASSES];    // workers of each class
+    int idle_next;      // index the next search for an idle worker starts at
+    double job_mean;    // moving mean of the job times, 0 before one (ms)
+    int* orphans;       // jobs of dead workers, for the manager to reassign
+    int orphans_len;
+    int orphans_cap;
     pthread_mutex_t lock;
-    pthread_t tid;
+    pthread_t tid;      // poller thread
+    int epoll_fd;       // status poll connections of all workers
+    int event_fd;       // wakes the poller
+    atomic_int running;
 } Crew;
 
 // Constructor and destructor
@@ -54,13 +113,21 @@ void crew_destroy(Crew* crew);
 
 // Methods
 int crew_add(Crew* crew, int id);
+int crew_add_remote(Crew* crew, int id, const char* addr);
 int crew_remove(Crew* crew, int id);
 int crew_get_status(Crew* crew, int id);
 int crew_get_job_status(Crew* crew, int id);
 int crew_assign_job(Crew* crew, Job* job);
+int crew_assign_class(Crew* crew, json_value* job, unsigned int classes);
+int crew_set_classes(Crew* crew, int id, unsigned int classes);
+int crew_idle_count(Crew* crew, unsigned int classes);
+int crew_get_health(Crew* crew, int id);
+int crew_take_orphans(Crew* crew, int** job_ids);
 int crew_unassign(Crew* crew, int id);
 
 void crew_send_command(Crew* crew, int id, const char* command);
 void crew_broadcast(Crew* crew, const char* command);
+int broadcast_command(Crew* crew, json_value* cmd, long timeout, crew_result** results);
+void crew_results_free(crew_result* results, int n);
 
 #endif
\ No newline at end of file
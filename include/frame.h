@@ -0,0 +1,30 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+// A frame is a 4 byte big-endian body length followed by the body. Messages
+// that start with '{' are unframed JSON objects from legacy clients, taken
+// once the object is closed, and whitespace around them is skipped.
+#define FRAME_HEADER_LEN 4
+#define FRAME_MAXLEN (64*1024*1024)
+
+typedef struct {
+    char* body;
+    size_t len;         // body length
+    size_t size;        // bytes taken up by the frame in the stream
+    int framed;         // 0 for legacy messages
+} frame;
+
+void frame_header_encode(char* data, size_t len);
+int frame_next(char* data, size_t len, frame* f);
+int frame_push(Buffer* buffer, const char* body, size_t len);
+
+// Blocking socket helpers
+int frame_send(int fd, const char* body, size_t len);
+char* frame_recv(int fd, size_t* len);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Values are bucketed by their top HISTOGRAM_SUB_BITS bits, so each bucket
+// is within 1/2^HISTOGRAM_SUB_BITS of the values it counts
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40   // larger values are counted in the last bucket
+#define HISTOGRAM_LEN ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+// Histogram, a log-linear histogram of unsigned values (HDR style). Values
+// are recorded by one thread and can be read by any thread.
+typedef struct _histogram {
+    atomic_ulong count;
+    atomic_ulong buckets[HISTOGRAM_LEN];
+} Histogram;
+
+Histogram* histogram_create(void);
+void histogram_destroy(Histogram* histogram);
+
+// Methods
+void histogram_record(Histogram* histogram, uint64_t value);
+uint64_t histogram_count(Histogram* histogram);
+uint64_t histogram_percentile(Histogram* histogram, double percentile);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _IDMAP_H
+#define _IDMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IDMAP_MINCAP 16     // slots, always a power of two
+
+// IdMap, an open-addressing hash table from non-negative ids to dense
+// indices. Slots are probed linearly and removals shift the following
+// entries back, so there are no tombstones and lookups stay short. The
+// table doubles once it is half full.
+typedef struct _idmap_slot {
+    int id;             // -1 for an empty slot
+    int index;
+} idmap_slot;
+
+typedef struct _idmap {
+    idmap_slot* slots;
+    size_t capacity;
+    size_t len;
+} IdMap;
+
+IdMap* idmap_create(size_t capacity);
+void idmap_destroy(IdMap* map);
+
+// Methods
+int idmap_get(const IdMap* map, int id);
+int idmap_put(IdMap* map, int id, int index);
+int idmap_remove(IdMap* map, int id);
+
+#endif
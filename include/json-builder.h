@@ -47,12 +47,28 @@ extern "C"
  * parsing.  Otherwise there will not be room for the extra state and
  * json-builder WILL invoke undefined behaviour.
  *
- * Also note that unlike json-parser, json-builder does not currently support
- * custom allocators (for no particular reason other than that it doesn't have
- * any settings or global state.)
+ * Custom allocators are set per thread with json_builder_set_settings, and
+ * apply to every value built (and freed) on that thread afterwards.
  */
 extern const size_t json_builder_extra;
 
+typedef struct json_builder_settings
+{
+   /* Custom allocator support (leave null to use malloc/realloc/free)
+    */
+   void * (* mem_alloc) (size_t, int zero, void * user_data);
+   void * (* mem_realloc) (void *, size_t, void * user_data);
+   void (* mem_free) (void *, void * user_data);
+
+   void * user_data;  /* will be passed to mem_alloc, mem_realloc and mem_free */
+
+} json_builder_settings;
+
+/* Sets the allocator used by json-builder on the calling thread.  Passing
+ * NULL restores malloc/realloc/free.
+ */
+void json_builder_set_settings (const json_builder_settings *);
+
 
 /*** Arrays
  ***
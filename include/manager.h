@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 #include "project.h"
 #include "crew.h"
 
@@ -51,6 +52,7 @@ typedef struct _manager {
     Crew* crew;
     RunningProject* running_project;
     sem_t lock;
+    atomic_uint version;    // bumped on every manager or project status change
 } Manager;
 
 Manager* manager_create(int id);
@@ -59,6 +61,7 @@ void manager_destroy(Manager* manager);
 // Commands
 int manager_get_status(Manager* manager);
 int manager_get_project_status(Manager* manager);
+unsigned int manager_get_version(Manager* manager);
 int manager_run_project(Manager* manager, Project* project);
 int manager_assign(Manager* manager, Project* project);
 int manager_unassign(Manager* manager);
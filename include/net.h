@@ -0,0 +1,26 @@
+#ifndef _NET_H
+#define _NET_H
+
+#include <sys/socket.h>
+
+#define NET_MAXFDS 128      // fds sent in one message
+
+// Socket address
+typedef struct {
+    struct sockaddr_storage ss;
+    socklen_t len;
+} net_addr;
+
+int net_addr_unix(net_addr* addr, const char* path);
+int net_addr_tcp(net_addr* addr, const char* hostport);
+
+int net_connect(const net_addr* addr);
+int net_connect_timeout(const net_addr* addr, long timeout);
+int net_set_timeout(int fd, long timeout);
+int net_connect_nonblock(const net_addr* addr);
+int net_listen_tcp(const char* hostport, int backlog, int reuseport);
+
+int net_send_fds(int sock, const int* fds, int n);
+int net_recv_fds(int sock, int* fds, int max);
+
+#endif
@@ -15,6 +15,7 @@ enum {
 
 typedef int (*command)(Pyoneer*);
 typedef int (*command_blueprint)(Pyoneer*, Blueprint*);
+typedef json_value* (*command_json)(Pyoneer*);
 typedef int (*signal)(Pyoneer*);
 
 typedef struct _pyoneer {
@@ -25,6 +26,8 @@ typedef struct _pyoneer {
     } as;
     command get_status;
     command get_blueprint_status;
+    command get_version;
+    command_json get_snapshot;
     command_blueprint run;
     command_blueprint assign;
     command_blueprint unassign;
@@ -26,5 +26,6 @@ json_value* task_encode(const Task* task);
 
 // Helpers
 Task* task_decode(const json_value* obj);
+json_value* task_status_encode(int status);
 
 #endif
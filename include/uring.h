@@ -0,0 +1,53 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// Uring, an io_uring instance with a provided buffer ring
+typedef struct _uring {
+    int ring_fd;
+    unsigned int to_submit;
+
+    // Submission queue
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int sq_local_tail;
+    struct io_uring_sqe* sqes;
+
+    // Completion queue
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* ring_ptr;
+    size_t ring_len;
+    size_t sqes_len;
+
+    // Provided buffers
+    struct io_uring_buf_ring* br;
+    size_t br_len;
+    char* bufs;
+    unsigned int buf_entries;
+    size_t buf_len;
+} Uring;
+
+Uring* uring_create(unsigned int entries, unsigned int cq_entries);
+void uring_destroy(Uring* ring);
+
+// Methods
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+int uring_submit(Uring* ring, int timeout);
+struct io_uring_cqe* uring_peek(Uring* ring);
+void uring_advance(Uring* ring);
+
+// Provided buffers
+int uring_buffers_create(Uring* ring, unsigned short bgid,
+    unsigned int entries, size_t len);
+char* uring_buffer(Uring* ring, unsigned short bid);
+void uring_buffer_return(Uring* ring, unsigned short bid);
+
+#endif
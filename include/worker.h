@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 
 #include "job.h"
 #include "json.h"
@@ -15,10 +16,14 @@ enum {
 
 struct _worker;
 
+struct _running_job;
+
 typedef struct _running_job_node {
-    job_node* task;
-    pid_t pid;
+    Task* task;
+    pid_t pid;          // 0 until the task starts
+    long start;         // start time, ms since the epoch
     pthread_t tid;
+    struct _running_job* rjob;
     struct _running_job_node *next;
 } running_job_node;
 
@@ -34,6 +39,7 @@ typedef struct _worker {
     int status;
     RunningJob* running_job;
     sem_t lock;
+    atomic_uint version;    // bumped on every worker or job status change
 } Worker;
 
 Worker* worker_create(int id);
@@ -42,6 +48,8 @@ void worker_destroy(Worker* worker);
 // Commands
 int worker_get_status(Worker* worker);
 int worker_get_job_status(Worker* worker);
+unsigned int worker_get_version(Worker* worker);
+json_value* worker_get_snapshot(Worker* worker);
 int worker_run(Worker* worker, Job* job);
 int worker_assign(Worker* worker, Job* job);
 int worker_unassign(Worker* worker, Job* job);
@@ -1,43 +1,150 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #include "api.h"
+#include "arena.h"
+#include "buffer.h"
+#include "frame.h"
+#include "histogram.h"
+#include "net.h"
+#include "uring.h"
 #include "json-builder.h"
 #include "json-helpers.h"
 
-#define BACKLOG 5
+#define BACKLOG SOMAXCONN
 #define BUFLEN 4096
-#define CAPACITY 8
+#define MAXEVENTS 64
+#define API_RECVLEN (16*BUFLEN) // requests a busy io_uring client buffers
+#define API_KEEPCAP (16*BUFLEN) // capacity an emptied client buffer keeps
+#define API_NTHREADS 4
+#define API_QUEUELEN 256
+#define API_ARENALEN (64*1024)
+#define API_WATCHTICK 10    // ms between status checks while clients watch
+#define API_URINGLEN 256        // io_uring submission queue entries
+#define API_URING_CQLEN 4096    // io_uring completion queue entries
+#define API_URING_BUFS 256      // provided receive buffers, a power of two
+#define API_URING_BGID 0
+#define API_MAXLOOPS 64         // listener threads with their own event loop
+#define API_DRAINLEN 5000       // default ms for in-flight requests to finish
 #define API_ERROR -1
 
 // Globals
 volatile sig_atomic_t sig_flag = 0;
 
 // Client status codes
-static enum {
+enum {
     CLIENT_ACTIVE,
     CLIENT_INACTIVE
 };
 
+struct api_job;
+struct api_loop;
+
+// Token bucket, refilled at its class rate up to the class burst
+struct api_bucket {
+    double tokens;
+    uint64_t refilled;      // ns timestamp of the last refill
+};
+
+// Rate limit of a command class, a rate of 0 is unlimited
+struct api_limit {
+    double rate;            // requests per second
+    double burst;
+};
+
+// Watch state, the statuses last pushed to a watching client
+struct api_watch {
+    int on;
+    int framed;
+    long interval;          // ms between pushes
+    long pushed;            // ms timestamp of the last push
+    int status;
+    int blueprint_status;
+};
+
 // Client structure
-static struct api_client {
+struct api_client {
     int status;
     int client_fd;
-    pthread_t tid;
+    uint32_t events;        // epoll events the server waits for
+    Buffer* in;             // partial requests
+    Buffer* out;            // unsent responses
+    Buffer* sent;           // responses io_uring is sending
+    int receiving;          // io_uring multishot recv is armed, 2 once cancelled
+    int sending;            // io_uring send is in flight
+    struct api_job* job;    // requests being handled by the pool
+    struct api_job* spare;  // emptied job, reused for the next requests
+    struct api_watch watch;
+    uint64_t recv_time;     // ns timestamp of the last receive
+    struct api_bucket buckets[API_NCLASSES];
     Api* server;
+    struct api_loop* loop;  // event loop serving the connection
     struct api_client* next;
+    struct api_client* prev;
+};
+
+// Job structure, a run of complete requests from one client
+struct api_job {
+    struct api_client* client;
+    Buffer* in;
+    Buffer* out;
+    struct api_watch watch; // set if the requests include a watch
+    uint64_t recv_time;
+    Buffer* codes;          // ApiCode of each request, for the latency histograms
+    int cls;                // ApiClass, control if any request is
+    struct api_job* next;
+};
+
+// io_uring request types, kept in the low bits of the request user data
+enum {
+    API_OP_ACCEPT = 1,
+    API_OP_EVENT,
+    API_OP_RECV,
+    API_OP_SEND,
+    API_OP_ACCEPT_TCP,
+    API_OP_CANCEL,
+    API_OP_HANDOFF,
+    API_OP_MASK = 7
+};
+
+// Cached response to a request that only names a status command
+struct api_cache {
+    int valid;
+    unsigned int version;   // pyoneer state version of the response
+    Buffer* req;            // request body
+    Buffer* resp;           // serialized response body
+};
+
+// Job queue
+struct api_queue {
+    struct api_job* head;
+    struct api_job* tail;
+    int len;
 };
 
 static const char* const API_MSG[] = {
     [API_SERVER_START]          = "API: starting server",
     [API_SERVER_STOP]           = "API: stopping server",
     [API_WORKING]               = "API: pyoneer is working",
-    [API_NOT_WORKING]           = "API: pyoneer is not working"
+    [API_NOT_WORKING]           = "API: pyoneer is not working",
+    [API_URING_FALLBACK]        = "API: io_uring unavailable, using epoll",
+    [API_SERVER_DRAIN]          = "API: draining connections",
+    [API_DRAIN_TIMEOUT]         = "API: drain deadline passed, closing busy connections",
+    [API_HANDOFF]               = "API: handed listening sockets to a new pyoneer",
+    [API_INHERIT]               = "API: took over listening sockets"
 };
 
 static const char* const API_ERROR_MSG[] = {
@@ -48,7 +155,35 @@ static const char* const API_ERROR_MSG[] = {
     [API_ERR_SIGNAL]            = "API: signal error",
     [API_ERR_JSON_PARSE]        = "API: json_parse - invalid JSON payload",
     [API_ERR_JSON_TYPE]         = "API: json_value - invalid JSON type",
-    [API_ERR_JSON_MISSING]      = "API: json_object - missing JSON value"
+    [API_ERR_JSON_MISSING]      = "API: json_object - missing JSON value",
+    [API_ERR_FRAME]             = "API: frame - invalid frame header",
+    [API_ERR_BUSY]              = "API: server busy",
+    [API_ERR_THROTTLED]         = "API: throttled"
+};
+
+// Event loop, each serves the connections accepted on its own sockets
+struct api_loop {
+    Api* server;
+    int server_fd;          // local socket, on the first loop only
+    int tcp_fd;             // TCP socket, bound with SO_REUSEPORT
+    int handoff_fd;         // hot restart socket, on the first loop only
+    int handoff_conn;       // new pyoneer waiting for the sockets
+    int epoll_fd;
+    Uring* ring;            // set while the io_uring backend is running
+    int event_fd;           // wakes the event loop when jobs are done
+    struct api_client* clients;
+    struct api_client* closed;  // closed clients waiting to be freed
+    struct api_queue done;      // jobs waiting to be sent, under the server lock
+    int nwatchers;
+    long watch_next;            // ms timestamp of the next status check
+    int watch_fresh;            // watchers have the statuses of watch_version
+    unsigned int watch_version;
+    int paused;                 // not accepting while a handoff waits
+    int accepts;                // armed io_uring accepts
+    int draining;               // not accepting, closes once idle
+    long drain_deadline;        // ms timestamp to close busy connections
+    pthread_t tid;
+    int running;                // has its own thread
 };
 
 // Api server
@@ -56,175 +191,561 @@ typedef struct _api {
     Pyoneer* pyoneer;
     Logger* logger;
     char* socket_path;
-    int server_fd;
-    struct api_client* clients;
+    char* tcp_addr;         // optional "host:port" to also listen on
+    char* handoff_path;     // optional local socket for hot restarts
+    int backend;
+    int nlisteners;         // event loops to start when listening on TCP
+    struct api_loop* loops;
+    int nloops;
+    atomic_int halt;        // stops the event loops
+    atomic_int handing_off; // pauses accepting on the event loops
+    atomic_int accepting;   // loops yet to pause for the handoff
+    long drain_timeout;     // ms the loops wait for in-flight requests
+    atomic_long drain_start;    // ms timestamp of the halt
+    atomic_int len;
+    pthread_mutex_t cache_lock;
+    struct api_cache cache[API_NCODES];
+    atomic_ulong calls[API_NCODES];
+
+    // Metrics
+    Histogram* latency[API_NCODES]; // ns from recv to send, per command
+    atomic_ulong parse_errors;
+    atomic_ulong oversize;          // responses over FRAME_MAXLEN
+    atomic_ulong throttled;
+
+    // Admission control
+    struct api_limit limits[API_NCLASSES];
+
+    // Handler pool
+    pthread_t threads[API_NTHREADS];
+    int nthreads;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct api_queue queue;     // jobs waiting for a handler
+    struct api_queue control;   // control jobs, handled first
 } Api;
 
-/* api_client_thread: Handles the clients api requests. */
-static void* api_client_thread(void* arg) {
-    struct api_client* client = (struct client*)arg;
-    Pyoneer* pyoneer = client->server->pyoneer;
-    Logger* logger = client->server->logger;
+/* api_push_response: Appends the response to the buffer, framed if the
+    request was framed. Returns 0 on success, and -1 otherwise. */
+static int api_push_response(Buffer* out, const char* resp, size_t len, int framed) {
+    if (framed) return frame_push(out, resp, len);
+    return buffer_append(out, resp, len);
+}
+
+// Request context
+struct api_request {
+    const char* buf;        // raw request, for logging
+    json_value* req;
+    json_value* resp;
+    int nested;             // set for commands inside a batch
+    int framed;
+    int code;
+    struct api_watch* watch;
+};
+
+typedef void (*api_handler)(Api* server, struct api_request* r);
+
+// Command handlers
+static void api_run(Api* server, struct api_request* r);
+static void api_get_status(Api* server, struct api_request* r);
+static void api_get_blueprint_status(Api* server, struct api_request* r);
+static void api_assign(Api* server, struct api_request* r);
+static void api_unassign(Api* server, struct api_request* r);
+static void api_start_signal(Api* server, struct api_request* r);
+static void api_stop_signal(Api* server, struct api_request* r);
+static void api_batch(Api* server, struct api_request* r);
+static void api_watch(Api* server, struct api_request* r);
+static void api_get_metrics(Api* server, struct api_request* r);
+static void api_get_snapshot(Api* server, struct api_request* r);
+
+// Command table
+static const struct api_command {
+    const char* name;
+    api_handler handler;
+    int cached;             // responses are cached per pyoneer state version
+    int control;            // changes the pyoneer, see ApiClass
+} API_COMMANDS[] = {
+    [API_RUN]                   = {"run", api_run, 0, 1},
+    [API_GET_STATUS]            = {"get_status", api_get_status, 1, 0},
+    [API_GET_BLUEPRINT_STATUS]  = {"get_blueprint_status", api_get_blueprint_status, 1, 0},
+    [API_ASSIGN]                = {"assign", api_assign, 0, 1},
+    [API_UNASSIGN]              = {"unassign", api_unassign, 0, 1},
+    [API_START]                 = {"start", api_start_signal, 0, 1},
+    [API_STOP]                  = {"stop", api_stop_signal, 0, 1},
+    [API_BATCH]                 = {"batch", api_batch},
+    [API_WATCH]                 = {"watch", api_watch},
+    [API_GET_METRICS]           = {"get_metrics", api_get_metrics},
+    [API_GET_SNAPSHOT]          = {"get_snapshot", api_get_snapshot, 1, 0}
+};
+
+#define API_NCOMMANDS (int)(sizeof(API_COMMANDS)/sizeof(API_COMMANDS[0]))
+#define API_TABLESIZE 32    // power of two, at least twice API_NCOMMANDS
+
+// Command name index, maps the hash of a command name to its ApiCode
+static int api_table[API_TABLESIZE];
+
+/* api_hash: Hashes the command name (FNV-1a). */
+static unsigned int api_hash(const char* name, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* api_table_init: Indexes the command table by command name. */
+static void api_table_init(void) {
+    for (int i = 0; i < API_TABLESIZE; i++)
+        api_table[i] = -1;
+
+    for (int code = 0; code < API_NCOMMANDS; code++) {
+        const char* name = API_COMMANDS[code].name;
+        if (name == NULL) continue;
+        unsigned int h = api_hash(name, strlen(name));
+        while (api_table[h & (API_TABLESIZE - 1)] != -1)
+            h++;
+        api_table[h & (API_TABLESIZE - 1)] = code;
+    }
+}
+
+/* api_lookup: Looks up the command by its name and returns its ApiCode.
+    Otherwise, returns -1. */
+static int api_lookup(const char* name, size_t len) {
+    unsigned int h = api_hash(name, len);
+    int code;
+    while ((code = api_table[h & (API_TABLESIZE - 1)]) != -1) {
+        const char* cmd = API_COMMANDS[code].name;
+        if (strncmp(cmd, name, len) == 0 && cmd[len] == '\0')
+            return code;
+        h++;
+    }
+    return -1;
+}
+
+/* api_error: Logs the error and adds it to the response. */
+static void api_error(Api* server, struct api_request* r, const char* msg) {
+    logger_info(server->logger, msg);
+    logger_debug(server->logger, r->buf);
+    json_object_push_string(r->resp, "Error", msg);
+}
+
+/* api_blueprint_decode: Decodes the request blueprint and returns it.
+    Otherwise, adds the error to the response and returns NULL. */
+static Blueprint* api_blueprint_decode(Api* server, struct api_request* r) {
+    json_value* val = json_object_get_value(r->req, "blueprint");
+    if (val == NULL) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_JSON_MISSING]);
+        return NULL;
+    }
+
+    Blueprint* blueprint = pyoneer_blueprint_decode(server->pyoneer, val);
+    if (blueprint == NULL) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_BLUEPRINT]);
+        return NULL;
+    }
+    return blueprint;
+}
+
+/* api_push_status: Adds the pyoneer status to the response. */
+static void api_push_status(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    json_value* status = pyoneer_status_encode(pyoneer->get_status(pyoneer));
+    json_object_push(r->resp, "status", status);
+}
+
+/* api_push_blueprint_status: Adds the blueprint status to the response. */
+static void api_push_blueprint_status(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    json_value* status = blueprint_status_encode(pyoneer->get_blueprint_status(pyoneer));
+    json_object_push(r->resp, "blueprint_status", status);
+}
+
+/* api_run: Runs the blueprint and responds with the pyoneer and blueprint
+    statuses. */
+static void api_run(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    Blueprint* blueprint = api_blueprint_decode(server, r);
+    if (blueprint == NULL) return;
+
+    if (pyoneer->run(pyoneer, blueprint) == -1) {
+        blueprint_destroy(blueprint);
+        api_error(server, r, API_MSG[API_WORKING]);
+        return;
+    }
+
+    api_push_status(server, r);
+    api_push_blueprint_status(server, r);
+}
+
+/* api_get_status: Responds with the pyoneer status. */
+static void api_get_status(Api* server, struct api_request* r) {
+    api_push_status(server, r);
+}
+
+/* api_get_blueprint_status: Responds with the blueprint status. */
+static void api_get_blueprint_status(Api* server, struct api_request* r) {
+    api_push_blueprint_status(server, r);
+}
+
+/* api_assign: Assigns the blueprint to the pyoneer. */
+static void api_assign(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    Blueprint* blueprint = api_blueprint_decode(server, r);
+    if (blueprint == NULL) return;
+
+    if (pyoneer->assign(pyoneer, blueprint) == -1) {
+        blueprint_destroy(blueprint);
+        api_error(server, r, API_MSG[API_WORKING]);
+    }
+}
+
+/* api_unassign: Unassigns the pyoneer's blueprint. */
+static void api_unassign(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    Blueprint* blueprint = NULL;
+    if (pyoneer->unassign(pyoneer, blueprint) == -1) {
+        logger_info(server->logger, API_ERROR_MSG[API_ERR_INTERNAL]);
+        logger_debug(server->logger, r->buf);
+        return;
+    }
+    blueprint_destroy(blueprint);
+}
+
+/* api_start_signal: Responds with the blueprint status. */
+static void api_start_signal(Api* server, struct api_request* r) {
+    api_push_blueprint_status(server, r);
+}
+
+/* api_stop_signal: Responds with the blueprint status. */
+static void api_stop_signal(Api* server, struct api_request* r) {
+    api_push_blueprint_status(server, r);
+}
+
+/* api_dispatch: Forward declaration for api_batch. */
+static void api_dispatch(Api* server, struct api_request* r);
+
+/* api_batch: Runs each command in the request's commands array in order
+    and responds with an array of their results. */
+static void api_batch(Api* server, struct api_request* r) {
+    json_value* cmds = json_object_get_value(r->req, "commands");
+    if (cmds == NULL) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_JSON_MISSING]);
+        return;
+    }
+
+    if (cmds->type != json_array) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_JSON_TYPE]);
+        return;
+    }
+
+    json_value* results = json_array_new(cmds->u.array.length);
+    if (results == NULL) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_INTERNAL]);
+        return;
+    }
+
+    for (unsigned int i = 0; i < cmds->u.array.length; i++) {
+        struct api_request cmd = {0};
+        cmd.buf = r->buf;
+        cmd.req = cmds->u.array.values[i];
+        cmd.resp = json_object_new(0);
+        cmd.nested = 1;
+        if (cmd.resp == NULL) {
+            json_builder_free(results);
+            api_error(server, r, API_ERROR_MSG[API_ERR_INTERNAL]);
+            return;
+        }
+        api_dispatch(server, &cmd);
+        json_array_push(results, cmd.resp);
+    }
+    json_object_push(r->resp, "results", results);
+}
+
+/* api_watch: Responds with the pyoneer and blueprint statuses and keeps
+    pushing them to the client whenever either changes. Changes within the
+    request's optional interval (ms) of the last push are coalesced. */
+static void api_watch(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    long interval = 0;
+    json_value* val = json_object_get_value(r->req, "interval");
+    if (val) {
+        if (val->type != json_integer || val->u.integer < 0) {
+            api_error(server, r, API_ERROR_MSG[API_ERR_JSON_TYPE]);
+            return;
+        }
+        interval = val->u.integer;
+    }
+
+    struct api_watch* watch = r->watch;
+    watch->on = 1;
+    watch->framed = r->framed;
+    watch->interval = interval;
+    watch->status = pyoneer->get_status(pyoneer);
+    watch->blueprint_status = pyoneer->get_blueprint_status(pyoneer);
+    json_object_push(r->resp, "status", pyoneer_status_encode(watch->status));
+    json_object_push(r->resp, "blueprint_status",
+        blueprint_status_encode(watch->blueprint_status));
+}
+
+/* api_get_metrics: Responds with the number of active connections, parse
+    errors and oversize responses, and the calls and latency percentiles
+    (ns from recv to send) of each command. */
+static void api_get_metrics(Api* server, struct api_request* r) {
+    json_value* metrics = json_object_new(0);
+    json_object_push(metrics, "connections", json_integer_new(atomic_load(&server->len)));
+    json_object_push(metrics, "parse_errors",
+        json_integer_new(atomic_load(&server->parse_errors)));
+    json_object_push(metrics, "oversize_responses",
+        json_integer_new(atomic_load(&server->oversize)));
+    json_object_push(metrics, "throttled",
+        json_integer_new(atomic_load(&server->throttled)));
+
+    json_value* cmds = json_object_new(0);
+    for (int code = 0; code < API_NCOMMANDS; code++) {
+        if (API_COMMANDS[code].name == NULL) continue;
+        Histogram* h = server->latency[code];
+        json_value* cmd = json_object_new(0);
+        json_object_push(cmd, "calls", json_integer_new(atomic_load(&server->calls[code])));
+        json_object_push(cmd, "count", json_integer_new(histogram_count(h)));
+        json_object_push(cmd, "p50", json_integer_new(histogram_percentile(h, 50.0)));
+        json_object_push(cmd, "p90", json_integer_new(histogram_percentile(h, 90.0)));
+        json_object_push(cmd, "p99", json_integer_new(histogram_percentile(h, 99.0)));
+        json_object_push(cmd, "p999", json_integer_new(histogram_percentile(h, 99.9)));
+        json_object_push(cmds, API_COMMANDS[code].name, cmd);
+    }
+    json_object_push(metrics, "commands", cmds);
+    json_object_push(r->resp, "metrics", metrics);
+}
+
+/* api_get_snapshot: Responds with the pyoneer's state as one snapshot, for
+    the pyoneers that have one. */
+static void api_get_snapshot(Api* server, struct api_request* r) {
+    Pyoneer* pyoneer = server->pyoneer;
+    json_value* snapshot;
+    if (pyoneer->get_snapshot == NULL || (snapshot = pyoneer->get_snapshot(pyoneer)) == NULL) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_CMD]);
+        return;
+    }
+    json_object_push(r->resp, "snapshot", snapshot);
+}
+
+/* api_dispatch: Looks up the request command, calls its handler and
+    fills in the response. */
+static void api_dispatch(Api* server, struct api_request* r) {
+    // Check object type
+    if (r->req->type != json_object) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_JSON_TYPE]);
+        return;
+    }
+
+    // Get command
+    json_value* cmd = json_object_get_value(r->req, "command");
+    if (cmd == NULL) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_JSON_MISSING]);
+        return;
+    }
+
+    if (cmd->type != json_string) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_JSON_TYPE]);
+        return;
+    }
+
+    int code = api_lookup(cmd->u.string.ptr, cmd->u.string.length);
+    if (code == -1) {
+        logger_debug(server->logger, r->buf);
+        json_object_push_string(r->resp, "Error", API_ERROR_MSG[API_ERR_CMD]);
+        return;
+    }
+
+    // Batches don't nest, and only top level requests can watch
+    if ((code == API_BATCH || code == API_WATCH) && r->nested) {
+        api_error(server, r, API_ERROR_MSG[API_ERR_CMD]);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&server->calls[code], 1, memory_order_relaxed);
+    r->code = code;
+    API_COMMANDS[code].handler(server, r);
+}
+
+/* api_cache_get: Appends the cached response to the request to out, if
+    there is one for the pyoneer's current state version, and sets code to
+    the request's ApiCode. Returns 1 if the response was cached, 0 if it
+    wasn't, and -1 otherwise. */
+static int api_cache_get(Api* server, const frame* f, Buffer* out, int* code) {
+    Pyoneer* pyoneer = server->pyoneer;
+    if (pyoneer->get_version == NULL) return 0;
+    unsigned int version = pyoneer->get_version(pyoneer);
+
+    int rv = 0;
+    int hit = -1;
+    pthread_mutex_lock(&server->cache_lock);
+    for (int code = 0; code < API_NCOMMANDS; code++) {
+        struct api_cache* cache = &server->cache[code];
+        if (!API_COMMANDS[code].cached || !cache->valid ||
+            cache->version != version || cache->req->len != f->len ||
+            memcmp(cache->req->data, f->body, f->len) != 0)
+            continue;
+
+        atomic_fetch_add_explicit(&server->calls[code], 1, memory_order_relaxed);
+        rv = api_push_response(out, cache->resp->data, cache->resp->len, f->framed);
+        rv = (rv == -1) ? -1 : 1;
+        hit = code;
+        break;
+    }
+    pthread_mutex_unlock(&server->cache_lock);
+    *code = hit;
+    return rv;
+}
+
+/* api_cache_put: Caches the serialized response to the request for the
+    given pyoneer state version. */
+static void api_cache_put(Api* server, int code, unsigned int version,
+    const char* req, size_t req_len, const char* resp, size_t resp_len) {
+    struct api_cache* cache = &server->cache[code];
+    pthread_mutex_lock(&server->cache_lock);
+    buffer_clear(cache->req);
+    buffer_clear(cache->resp);
+    cache->version = version;
+    cache->valid = (buffer_append(cache->req, req, req_len) == 0 &&
+        buffer_append(cache->resp, resp, resp_len) == 0);
+    pthread_mutex_unlock(&server->cache_lock);
+}
+
+/* api_handle_request: Handles a single null terminated api request and
+    appends the serialized response to out. If arena is not NULL, the
+    request and response are allocated from the arena, which is reset
+    afterwards. The thread's json-builder settings must use the same arena.
+    A watch request fills in watch. Responses to requests that only name a
+    cached command are cached for the pyoneer state version they were
+    handled at. Returns the request's ApiCode, or -1 if it has none. */
+static int api_handle_request(Api* server, Arena* arena, char* buf,
+    size_t nbytes, Buffer* out, int framed, struct api_watch* watch) {
+    Logger* logger = server->logger;
+    const char* failure = "{\"error\":\"api failure\"}";
 
     json_settings settings = {0};
     settings.value_extra = json_builder_extra;
+    if (arena) {
+        settings.mem_alloc = arena_mem_alloc;
+        settings.mem_free = arena_mem_free;
+        settings.user_data = arena;
+    }
     char error[json_error_max];
 
-    int nbytes;
-    char buf[BUFLEN];
-    while ((nbytes = recv(client->client_fd, buf, BUFLEN, 0)) > 0) {
-        buf[(nbytes >= BUFLEN) ? BUFLEN - 1 : nbytes] = '\0';
-        json_value* resp = json_object_new(0);
-        if (resp == NULL) {
-            logger_debug(logger, API_ERROR_MSG[API_ERR_INTERNAL]);
-            break;
-        }
+    // The version is read first, a status change makes the response stale
+    Pyoneer* pyoneer = server->pyoneer;
+    unsigned int version = 0;
+    if (pyoneer->get_version) version = pyoneer->get_version(pyoneer);
 
-        json_value* req = json_parse_ex(&settings, buf, nbytes, error);
-        if (req == NULL) {
-            logger_info(logger, API_ERROR_MSG[API_ERR_JSON_PARSE]);
-            logger_debug(logger, buf);
-            json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_JSON_PARSE]);
-            goto send;
-        }
+    struct api_request r = {0};
+    r.buf = buf;
+    r.framed = framed;
+    r.code = -1;
+    r.watch = watch;
+    r.resp = json_object_new(0);
+    if (r.resp == NULL) {
+        logger_debug(logger, API_ERROR_MSG[API_ERR_INTERNAL]);
+        api_push_response(out, failure, strlen(failure), framed);
+        if (arena) arena_reset(arena);
+        return -1;
+    }
 
-        // Check object type
-        if (req->type != json_object) {
-            logger_info(logger, API_ERROR_MSG[API_ERR_JSON_TYPE]);
-            logger_debug(logger, buf);
-            json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_JSON_TYPE]);
-            goto send;
-        }
+    r.req = json_parse_ex(&settings, buf, nbytes, error);
+    if (r.req == NULL) {
+        atomic_fetch_add_explicit(&server->parse_errors, 1, memory_order_relaxed);
+        api_error(server, &r, API_ERROR_MSG[API_ERR_JSON_PARSE]);
+    } else
+        api_dispatch(server, &r);
 
-        // Get command
-        json_value* cmd = json_object_get_value(req, "command");
-        if (cmd == NULL) {
-            logger_info(logger, API_ERROR_MSG[API_ERR_JSON_MISSING]);
-            logger_debug(logger, buf);
-            json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_JSON_MISSING]);
-            goto send;
-        }
+    // Serialize the response in place, after the frame header
+    size_t hdr = framed ? FRAME_HEADER_LEN : 0;
+    size_t len = json_measure(r.resp);
+    if (len > FRAME_MAXLEN)
+        atomic_fetch_add_explicit(&server->oversize, 1, memory_order_relaxed);
+    if (len > FRAME_MAXLEN || buffer_reserve(out, hdr + len) == -1) {
+        logger_info(logger, API_ERROR_MSG[API_ERR_INTERNAL]);
+        logger_debug(logger, buf);
+        api_push_response(out, failure, strlen(failure), framed);
+    } else {
+        char* body = out->data + out->len + hdr;
+        json_serialize(body, r.resp);
+        logger_debug(logger, body);
 
-        // Call pyoneer commands and signals
-        if (strcmp(cmd->u.string.ptr, "run") == 0) {
-            json_value* val = json_get_object_value(req, "blueprint");
-            if (val == NULL) {
-                logger_info(logger, API_ERROR_MSG[API_ERR_JSON_MISSING]);
-                logger_debug(logger, buf);
-                json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_JSON_MISSING]);
-                goto send;
-            }
+        size_t n = strlen(body);
+        if (pyoneer->get_version && r.code != -1 && API_COMMANDS[r.code].cached &&
+            r.req->u.object.length == 1)
+            api_cache_put(server, r.code, version, buf, nbytes, body, n);
+        if (framed) frame_header_encode(out->data + out->len, n);
+        out->len += hdr + n;
+    }
 
-            Blueprint* blueprint = pyoneer_blueprint_decode(pyoneer, val);
-            if (blueprint == NULL) {
-                logger_info(logger, API_ERROR_MSG[API_ERR_BLUEPRINT]);
-                logger_debug(logger, buf);
-                json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_BLUEPRINT]);
-                goto send;
-            }
+    if (arena) {
+        arena_reset(arena);
+        return r.code;
+    }
+    if (r.req) json_value_free(r.req);
+    json_builder_free(r.resp);
+    return r.code;
+}
 
-            if (pyoneer->run(pyoneer, blueprint) == -1) {
-                blueprint_destroy(blueprint);
-                json_object_push_string(resp, "Error", API_MSG[API_WORKING]);
-                goto send;
-            }
-            
-            json_value* status = pyoneer_status_encode(pyoneer->get_status(pyoneer));
-            json_object_push(resp, "status", status);
-
-            status = blueprint_status_encode(pyoneer->get_blueprint_status(pyoneer));
-            json_object_push(resp, "blueprint_status", status);
-        }
-        // get_status
-        else if (strcmp(cmd->u.string.ptr, "get_status") == 0) {
-            json_value* status = pyoneer_status_encode(pyoneer->get_status(pyoneer));
-            json_object_push(resp, "status", status);
-        } 
-        // get_blueprint_status
-        else if (strcmp(cmd->u.string.ptr, "get_blueprint_status") == 0) {
-            json_value* status = blueprint_status_encode(pyoneer->get_blueprint_status(pyoneer));
-            json_object_push(resp, "blueprint_status", status);
-        }
-        // assign
-        else if (strcmp(cmd->u.string.ptr, "assign") == 0) {
-            json_value* val = json_get_object_value(req, "blueprint");
-            if (val == NULL) {
-                logger_info(logger, API_ERROR_MSG[API_ERR_JSON_MISSING]);
-                logger_debug(logger, buf);
-                goto send;
-            }
+/* api_cache_destroy: Frees the response caches. */
+static void api_cache_destroy(Api* server) {
+    for (int code = 0; code < API_NCODES; code++) {
+        buffer_destroy(server->cache[code].req);
+        buffer_destroy(server->cache[code].resp);
+    }
+    pthread_mutex_destroy(&server->cache_lock);
+}
 
-            Blueprint* blueprint = pyoneer_blueprint_decode(pyoneer, val);
-            if (blueprint == NULL) {
-                logger_info(logger, API_ERROR_MSG[API_ERR_BLUEPRINT]);
-                logger_debug(logger, buf);
-                json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_BLUEPRINT]);
-                goto send;
-            }
+/* api_cache_create: Creates the response caches of the cached commands.
+    Returns 0 on success, and -1 otherwise. */
+static int api_cache_create(Api* server) {
+    memset(server->cache, 0, sizeof(server->cache));
+    int err = pthread_mutex_init(&server->cache_lock, NULL);
+    if (err != 0) {
+        fprintf(stderr, "api_cache_create: pthread_mutex_init: %s\n", strerror(err));
+        return -1;
+    }
 
-            if (pyoneer->assign(pyoneer, blueprint) == -1) {
-                blueprint_destroy(blueprint);
-                logger_info(logger, API_MSG[API_WORKING]);
-                json_object_push_string(resp, "Error", API_MSG[API_WORKING]);
-                goto send;
-            }
-        }
-        // unassign
-        else if (strcmp(cmd->u.string.ptr, "unassign") == 0) {
-            Blueprint* blueprint = NULL;
-            if (pyoneer->unassign(pyoneer, blueprint) == -1) {
-                logger_info(logger, API_ERROR_MSG[API_ERR_INTERNAL]);
-                // TODO: Add debug info
-                goto send;
-            }
-            blueprint_destroy(blueprint);
-        }
-        // start
-        else if (strcmp(cmd->u.string.ptr, "start") == 0) {
-            json_value* status = blueprint_status_encode(
-                pyoneer->get_blueprint_status(pyoneer));
-            json_object_push(resp, "blueprint_status", status);
-        }
-        // Stop
-        else if (strcmp(cmd->u.string.ptr, "stop") == 0) {
-            json_value* status = blueprint_status_encode(
-                pyoneer->get_blueprint_status(pyoneer)
-            );
-            json_object_push(resp, "blueprint_status", status);
-        }
-        // Unknown command
-        else {
-            logger_debug(logger, buf);
-            json_object_push_string(resp, "Error", API_ERROR_MSG[API_ERR_CMD]);
-        }
-
-        send:
-        if (json_measure(resp) > BUFLEN) {
-            sig_flag = -1; // Exit loop
-            logger_info(logger, API_ERROR_MSG[API_ERR_INTERNAL]);
-            logger_info(logger, API_ERROR_MSG[API_ERR_SHUTTING_DOWN]);
-            logger_debug(logger, buf);
-            strcpy(buf, "{\"error\":\"api failure\"}");
-        } else {
-            json_serialize(buf, resp);
-            logger_debug(logger, buf);
+    for (int code = 0; code < API_NCOMMANDS; code++) {
+        if (!API_COMMANDS[code].cached) continue;
+        server->cache[code].req = buffer_create(0);
+        server->cache[code].resp = buffer_create(0);
+        if (server->cache[code].req == NULL || server->cache[code].resp == NULL) {
+            api_cache_destroy(server);
+            return -1;
         }
+    }
+    return 0;
+}
 
-        if (send(client->client_fd, buf, strlen(buf), 0) == -1) {
-            sig_flag = -1; // Exit loop
-            perror("api: send");
-        }
+/* api_metrics_destroy: Frees the latency histograms. */
+static void api_metrics_destroy(Api* server) {
+    for (int code = 0; code < API_NCODES; code++)
+        histogram_destroy(server->latency[code]);
+}
 
-        json_builder_free(resp);
+/* api_metrics_create: Creates a latency histogram for each command.
+    Returns 0 on success, and -1 otherwise. */
+static int api_metrics_create(Api* server) {
+    memset(server->latency, 0, sizeof(server->latency));
+    for (int code = 0; code < API_NCOMMANDS; code++) {
+        if (API_COMMANDS[code].name == NULL) continue;
+        server->latency[code] = histogram_create();
+        if (server->latency[code] == NULL) {
+            api_metrics_destroy(server);
+            return -1;
+        }
     }
-
-    // close socket
-    close(client->client_fd);
-    return NULL;
+    return 0;
 }
 
 /* api_signal_handler: Handles the signal to the Api server. */
 static void api_signal_handler(int signo) {
+    (void)signo;
     sig_flag = 1;
 }
 
@@ -235,7 +756,7 @@ Api* api_create(Pyoneer* pyoneer, Logger* logger, const char* socket_path) {
         perror("api_create: malloc");
         return NULL;
     }
-    
+
     server->pyoneer = pyoneer;
     server->logger = logger;
 
@@ -249,8 +770,65 @@ Api* api_create(Pyoneer* pyoneer, Logger* logger, const char* socket_path) {
     strncpy(server->socket_path, socket_path, len);
     server->socket_path[len] = '\0';
 
-    server->server_fd = -1;
-    server->clients = NULL;
+    server->tcp_addr = NULL;
+    server->handoff_path = NULL;
+    server->backend = API_BACKEND_EPOLL;
+    server->nlisteners = 1;
+    server->loops = NULL;
+    server->nloops = 0;
+    atomic_init(&server->halt, 0);
+    atomic_init(&server->handing_off, 0);
+    atomic_init(&server->accepting, 0);
+    server->drain_timeout = API_DRAINLEN;
+    atomic_init(&server->drain_start, 0);
+    server->len = 0;
+    for (int i = 0; i < API_NCODES; i++)
+        atomic_init(&server->calls[i], 0);
+    atomic_init(&server->parse_errors, 0);
+    atomic_init(&server->oversize, 0);
+    atomic_init(&server->throttled, 0);
+    for (int i = 0; i < API_NCLASSES; i++)
+        server->limits[i] = (struct api_limit){0};
+    api_table_init();
+
+    server->nthreads = 0;
+    server->stopping = 0;
+    server->queue = (struct api_queue){0};
+    server->control = (struct api_queue){0};
+
+    int err = pthread_mutex_init(&server->lock, NULL);
+    if (err != 0) {
+        fprintf(stderr, "api_create: pthread_mutex_init: %s\n", strerror(err));
+        free(server->socket_path);
+        free(server);
+        return NULL;
+    }
+
+    err = pthread_cond_init(&server->cond, NULL);
+    if (err != 0) {
+        fprintf(stderr, "api_create: pthread_cond_init: %s\n", strerror(err));
+        pthread_mutex_destroy(&server->lock);
+        free(server->socket_path);
+        free(server);
+        return NULL;
+    }
+
+    if (api_cache_create(server) == -1) {
+        pthread_cond_destroy(&server->cond);
+        pthread_mutex_destroy(&server->lock);
+        free(server->socket_path);
+        free(server);
+        return NULL;
+    }
+
+    if (api_metrics_create(server) == -1) {
+        api_cache_destroy(server);
+        pthread_cond_destroy(&server->cond);
+        pthread_mutex_destroy(&server->lock);
+        free(server->socket_path);
+        free(server);
+        return NULL;
+    }
 
     struct sigaction sa = {0};
     sa.sa_handler = api_signal_handler;
@@ -259,6 +837,10 @@ Api* api_create(Pyoneer* pyoneer, Logger* logger, const char* socket_path) {
 
     if (sigaction(SIGINT, &sa, NULL) == -1) {
         perror("api_create: sigaction");
+        api_metrics_destroy(server);
+        api_cache_destroy(server);
+        pthread_cond_destroy(&server->cond);
+        pthread_mutex_destroy(&server->lock);
         free(server->socket_path);
         free(server);
         return NULL;
@@ -272,7 +854,13 @@ void api_destroy(Api* server) {
     if (server == NULL) return;
 
     api_stop(server);
+    api_metrics_destroy(server);
+    api_cache_destroy(server);
+    pthread_cond_destroy(&server->cond);
+    pthread_mutex_destroy(&server->lock);
     free(server->socket_path);
+    free(server->tcp_addr);
+    free(server->handoff_path);
     free(server);
 
     struct sigaction sa;
@@ -283,127 +871,1634 @@ void api_destroy(Api* server) {
         perror("api_destroy: sigaction");
 }
 
-/* api_add_client: Adds a client to the server and returns a pointer to the
-    newly created client */
-static struct api_client* api_add_client(Api* server, int client_fd) {
-    struct api_client* client = malloc(sizeof(struct api_client));
-    if (client == NULL) {
-        perror("api_add_client: malloc");
+/* api_queue_push: Adds the job to the tail of the queue. */
+static void api_queue_push(struct api_queue* q, struct api_job* job) {
+    job->next = NULL;
+    if (q->len++ == 0)
+        q->head = job;
+    else
+        q->tail->next = job;
+    q->tail = job;
+}
+
+/* api_queue_pop: Removes the job at the head of the queue and returns it.
+    Otherwise, returns NULL. */
+static struct api_job* api_queue_pop(struct api_queue* q) {
+    struct api_job* job = q->head;
+    if (job == NULL) return NULL;
+    q->head = job->next;
+    if (--q->len == 0)
+        q->tail = NULL;
+    job->next = NULL;
+    return job;
+}
+
+/* api_job_destroy: Frees the job and its buffers. */
+static void api_job_destroy(struct api_job* job) {
+    if (job == NULL) return;
+    buffer_destroy(job->in);
+    buffer_destroy(job->out);
+    buffer_destroy(job->codes);
+    free(job);
+}
+
+/* api_job_create: Creates an empty job for the client's requests. Returns
+    a pointer to the job on success, and NULL otherwise. */
+static struct api_job* api_job_create(struct api_client* client) {
+    struct api_job* job = malloc(sizeof(struct api_job));
+    if (job == NULL) {
+        perror("api_job_create: malloc");
         return NULL;
     }
-
-    client->client_fd = client_fd;
-    client->status = CLIENT_ACTIVE;
-    client->server = server;
-    client->next = NULL;
-
-    struct api_client* curr = server->clients;
-    struct api_client* prev = NULL;
-    while (curr) {
-        if (curr->status == CLIENT_INACTIVE) {
-            struct api_client* tmp = curr->next;
-            if (prev){
-                prev->next = tmp;
-            } else {
-                server->clients = tmp;
-            }
-            free(curr);
-            curr = tmp;
-        } else {
-            prev = curr;
-            curr = curr->next;
-        }
+    job->client = client;
+    job->in = buffer_create(0);
+    job->out = buffer_create(0);
+    job->codes = buffer_create(0);
+    job->next = NULL;
+    if (job->in == NULL || job->out == NULL || job->codes == NULL) {
+        api_job_destroy(job);
+        return NULL;
     }
+    return job;
+}
 
-    if (prev) {
-        prev->next = client;
-    } else {
-        server->clients = client;
+/* api_buffer_trim: Frees the memory of the emptied buffer if it grew past
+    API_KEEPCAP, so idle clients don't hold on to large requests or
+    responses. Smaller buffers keep theirs for the next ones. */
+static void api_buffer_trim(Buffer* buffer) {
+    if (buffer->len == 0 && buffer->capacity > API_KEEPCAP)
+        buffer_release(buffer);
+}
+
+/* api_job_recycle: Empties the job and keeps it as its client's spare, so
+    the client's next requests don't allocate. */
+static void api_job_recycle(struct api_job* job) {
+    Buffer* bufs[] = {job->in, job->out, job->codes};
+    for (size_t i = 0; i < sizeof(bufs)/sizeof(bufs[0]); i++) {
+        buffer_clear(bufs[i]);
+        api_buffer_trim(bufs[i]);
     }
+    api_job_destroy(job->client->spare);
+    job->client->spare = job;
+}
 
-    return client;
+/* api_job_run: Handles each request in the job in order and appends their
+    responses to the job's output. */
+static void api_job_run(Api* server, Arena* arena, struct api_job* job) {
+    char* data = job->in->data;
+    size_t len = job->in->len;
+    size_t off = 0;
+    frame f;
+    while (frame_next(data + off, len - off, &f) == 1) {
+        // Terminate the body in place, the next byte is always addressable
+        char c = f.body[f.len];
+        f.body[f.len] = '\0';
+        int code = api_handle_request(server, arena, f.body, f.len, job->out,
+            f.framed, &job->watch);
+        if (code != -1) {
+            unsigned char byte = code;
+            buffer_append(job->codes, (char*)&byte, 1);
+        }
+        f.body[f.len] = c;
+        off += f.size;
+    }
 }
 
-/* api_start: Creates a socket and listens for client connections. If the
-    process encounters an interupt, the server stops listening for new
-    client connections and returns 0. Otherwise, returns -1. */
-int api_start(Api* server) {
-    if (server == NULL) return -1;
+/* api_worker_thread: Handles jobs from the queue until the server stops.
+    Each thread parses and builds its requests in its own arena, so handling
+    a request doesn't allocate once the arena has grown large enough. */
+static void* api_worker_thread(void* arg) {
+    Api* server = arg;
 
-    // Create local socket
-    server->server_fd = socket(AF_LOCAL, SOCK_STREAM, 0);
-    if (server->server_fd == -1) {
-        perror("api_start: socket");
-        return -1;
+    // Fall back to malloc if the arena can't be created
+    Arena* arena = arena_create(API_ARENALEN);
+    if (arena) {
+        json_builder_settings settings = {0};
+        settings.mem_alloc = arena_mem_alloc;
+        settings.mem_realloc = arena_mem_realloc;
+        settings.mem_free = arena_mem_free;
+        settings.user_data = arena;
+        json_builder_set_settings(&settings);
     }
 
-    if (unlink(server->socket_path) == -1) {
-        perror("api_server_run: unlink");
-        close(server->server_fd);
-        return -1;
-    }
+    while (1) {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue.len == 0 && server->control.len == 0 &&
+            server->stopping == 0)
+            pthread_cond_wait(&server->cond, &server->lock);
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
 
-    struct sockaddr_un addr = {0};
-    addr.sun_family = AF_LOCAL;
-    strncpy(addr.sun_path, server->socket_path, sizeof(addr.sun_path));
+        // Control jobs go first, so reads can't starve them
+        struct api_job* job = api_queue_pop(&server->control);
+        if (job == NULL) job = api_queue_pop(&server->queue);
+        pthread_mutex_unlock(&server->lock);
 
-    if (bind(server->server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-        perror("api_server_run: bind");
-        close(server->server_fd);
-        return -1;
-    }
+        api_job_run(server, arena, job);
 
-    if (listen(server->server_fd, BACKLOG) == -1) {
-        perror("api_server_run: listen");
-        close(server->server_fd);
-        return -1;
+        struct api_loop* loop = job->client->loop;
+        pthread_mutex_lock(&server->lock);
+        api_queue_push(&loop->done, job);
+        pthread_mutex_unlock(&server->lock);
+
+        // Wake up the client's event loop
+        uint64_t one = 1;
+        if (write(loop->event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+            perror("api_worker_thread: write");
     }
 
-    logger_info(server->logger, API_MSG[API_SERVER_START]);
-    logger_debug(server->logger, server->socket_path);
+    json_builder_set_settings(NULL);
+    arena_destroy(arena);
+    return NULL;
+}
 
-    while (sig_flag != 1) {
-        int client_fd = accept(server->server_fd, NULL, NULL);
-        if (client_fd == -1) {
-            if (errno == EINTR) continue;
-            perror("api_server_run: accept");
-            break;
-        }
+/* api_now: Returns the monotonic time in ms. */
+static long api_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-        struct api_client* client = api_server_add_client(server, client_fd);
-        if (client == NULL) {
-            close(client_fd);
-            continue;
-        }
+/* api_clock: Returns the monotonic time in ns. */
+static uint64_t api_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-        int err = pthread_create(&client->tid, NULL, api_client_thread, client);
-        if (err != 0) {
-            fprintf(stderr, "api_server_run: pthread_create: %s\n", strerror(err));
-            break;
-        }
+/* api_client_destroy: Frees the client. */
+static void api_client_destroy(struct api_client* client) {
+    api_job_destroy(client->spare);
+    buffer_destroy(client->in);
+    buffer_destroy(client->out);
+    buffer_destroy(client->sent);
+    free(client);
+}
+
+/* api_uring_recv: Arms a multishot receive into the provided buffers on the
+    client connection. Returns 0 on success, and -1 otherwise. */
+static int api_uring_recv(struct api_loop* loop, struct api_client* client) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop->ring);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->client_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = API_URING_BGID;
+    sqe->user_data = (uintptr_t)client | API_OP_RECV;
+    client->receiving = 1;
+    return 0;
+}
+
+/* api_uring_send: Sends the client's responses with io_uring, unless a send
+    is already in flight. The responses are moved to the sent buffer, so new
+    responses can be added while the kernel reads it. Returns 0 on success,
+    and -1 otherwise. */
+static int api_uring_send(struct api_loop* loop, struct api_client* client) {
+    if (client->sending) return 0;
+    if (client->sent->len == 0) {
+        if (client->out->len == 0) return 0;
+        Buffer* sent = client->sent;
+        client->sent = client->out;
+        client->out = sent;
     }
 
+    struct io_uring_sqe* sqe = uring_get_sqe(loop->ring);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = client->client_fd;
+    sqe->addr = (uintptr_t)client->sent->data;
+    sqe->len = client->sent->len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)client | API_OP_SEND;
+    client->sending = 1;
     return 0;
 }
 
-/* api_stop: Stops the server and frees all resources, and returns 0. */
-int api_stop(Api* server) {
-    if (server == NULL) return 0;
-    logger_info(server->logger, API_MSG[API_SERVER_STOP]);
+/* api_uring_cancel: Cancels the request with the op on the loop's
+    listening sockets or, if ptr isn't the loop, on the client ptr. Returns
+    0 on success, and -1 otherwise. */
+static int api_uring_cancel(struct api_loop* loop, void* ptr, int op) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop->ring);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uintptr_t)ptr | op;
+    sqe->user_data = (uintptr_t)loop | API_OP_CANCEL;
+    return 0;
+}
 
-    struct api_client* curr = server->clients;
-    while (curr) {
-        struct api_client* next = curr->next;
-        if (curr->status == CLIENT_ACTIVE) {
-            int err = pthread_cancel(curr->tid);
-            if (err != 0)
-                fprintf(stderr, "api_stop: pthread_cancel: %s\n", strerror(err));
-        }
-        free(curr);
-        curr = next;
+/* api_add_client: Adds a client to the event loop, registers it with the
+    loop's epoll instance or io_uring and returns a pointer to the newly
+    created client. Otherwise, returns NULL. */
+static struct api_client* api_add_client(struct api_loop* loop, int client_fd) {
+    Api* server = loop->server;
+    struct api_client* client = malloc(sizeof(struct api_client));
+    if (client == NULL) {
+        perror("api_add_client: malloc");
+        return NULL;
+    }
+
+    client->status = CLIENT_ACTIVE;
+    client->client_fd = client_fd;
+    client->events = EPOLLIN;
+    client->receiving = 0;
+    client->sending = 0;
+    client->job = NULL;
+    client->spare = NULL;
+    client->watch = (struct api_watch){0};
+    client->recv_time = 0;
+    for (int i = 0; i < API_NCLASSES; i++) {
+        client->buckets[i].tokens = server->limits[i].burst;
+        client->buckets[i].refilled = api_clock();
     }
-    server->clients = NULL;
-    close(server->server_fd);
-    server->server_fd = -1;
+    client->server = server;
+    client->loop = loop;
+    client->in = buffer_create(0);
+    client->out = buffer_create(0);
+    client->sent = buffer_create(0);
+    if (client->in == NULL || client->out == NULL || client->sent == NULL) {
+        api_client_destroy(client);
+        return NULL;
+    }
+
+    if (loop->ring) {
+        if (api_uring_recv(loop, client) == -1) {
+            api_client_destroy(client);
+            return NULL;
+        }
+    } else {
+        struct epoll_event ev = {0};
+        ev.events = client->events;
+        ev.data.ptr = client;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            perror("api_add_client: epoll_ctl");
+            api_client_destroy(client);
+            return NULL;
+        }
+    }
+
+    // Add the client to the head of the list
+    client->prev = NULL;
+    client->next = loop->clients;
+    if (loop->clients)
+        loop->clients->prev = client;
+    loop->clients = client;
+    server->len++;
+    return client;
+}
+
+/* api_remove_client: Closes the client connection and moves the client to
+    the closed list. The client is freed by api_reap_clients, since events
+    for it may still be pending in the current batch. */
+static void api_remove_client(struct api_loop* loop, struct api_client* client) {
+    if (client->status == CLIENT_INACTIVE) return;
+
+    if (client->prev)
+        client->prev->next = client->next;
+    else
+        loop->clients = client->next;
+    if (client->next)
+        client->next->prev = client->prev;
+    loop->server->len--;
+    if (client->watch.on) loop->nwatchers--;
+
+    // closing the fd also removes it from the epoll interest list, while
+    // shutting it down completes the client's io_uring requests
+    if (loop->ring) shutdown(client->client_fd, SHUT_RDWR);
+    close(client->client_fd);
+    client->status = CLIENT_INACTIVE;
+    client->prev = NULL;
+    client->next = loop->closed;
+    loop->closed = client;
+}
+
+/* api_reap_clients: Frees the closed clients, unless the pool or io_uring
+    is still handling their requests. */
+static void api_reap_clients(struct api_loop* loop) {
+    struct api_client** curr = &loop->closed;
+    while (*curr) {
+        struct api_client* client = *curr;
+        if (client->job || client->receiving || client->sending) {
+            curr = &client->next;
+            continue;
+        }
+        *curr = client->next;
+        api_client_destroy(client);
+    }
+}
+
+/* api_client_watch: Updates the epoll events the server waits for on the
+    client connection. The server waits for the socket to become writable
+    while responses are pending, and doesn't read while the pool is handling
+    the client's requests. Returns 0 on success, and -1 otherwise. */
+static int api_client_watch(struct api_client* client) {
+    // io_uring receives until a busy client buffered API_RECVLEN bytes of
+    // requests, then stops like epoll until the client is idle again
+    struct api_loop* loop = client->loop;
+    if (loop->ring) {
+        int busy = client->job || client->out->len > 0 || client->sent->len > 0;
+        int full = busy && client->in->len >= API_RECVLEN;
+        if (full && client->receiving == 1) {
+            if (api_uring_cancel(loop, client, API_OP_RECV) == -1) return -1;
+            client->receiving = 2;
+        } else if (!full && client->receiving == 0 && api_uring_recv(loop, client) == -1) {
+            return -1;
+        }
+        return api_uring_send(loop, client);
+    }
+
+    uint32_t events = 0;
+    if (client->out->len > 0)
+        events = EPOLLOUT;
+    else if (client->job == NULL)
+        events = EPOLLIN;
+    if (events == client->events) return 0;
+
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = client;
+    if (epoll_ctl(client->loop->epoll_fd, EPOLL_CTL_MOD,
+        client->client_fd, &ev) == -1) {
+        perror("api_client_watch: epoll_ctl");
+        return -1;
+    }
+    client->events = events;
+    return 0;
+}
+
+/* api_client_flush: Sends as many of the client's responses as the socket
+    takes. Returns 0 on success, and -1 if the connection failed. */
+static int api_client_flush(struct api_client* client) {
+    // io_uring sends the responses once the client is watched
+    if (client->loop->ring) return 0;
+
+    Buffer* out = client->out;
+    size_t off = 0;
+    while (off < out->len) {
+        ssize_t nbytes = send(client->client_fd, out->data + off,
+            out->len - off, MSG_NOSIGNAL);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("api_client_flush: send");
+            return -1;
+        }
+        off += nbytes;
+    }
+    buffer_consume(out, off);
+    api_buffer_trim(out);
+    return 0;
+}
+
+/* api_client_reject: Responds to each request in data with the error. */
+static int api_client_reject(struct api_client* client, char* data, size_t len,
+    ApiErrorCode code) {
+    char resp[64];
+    int n = snprintf(resp, sizeof(resp), "{\"Error\":\"%s\"}", API_ERROR_MSG[code]);
+    size_t off = 0;
+    frame f;
+    while (frame_next(data + off, len - off, &f) == 1) {
+        if (api_push_response(client->out, resp, n, f.framed) == -1)
+            return -1;
+        off += f.size;
+    }
+    return 0;
+}
+
+/* api_skip_space: Returns the first byte from p that isn't whitespace. */
+static const char* api_skip_space(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+    return p;
+}
+
+/* api_skip_string: Returns the closing quote of the JSON string whose
+    first byte is p, or end if the string is cut short. Sets escaped if the
+    string has escapes. */
+static const char* api_skip_string(const char* p, const char* end, int* escaped) {
+    while (p < end && *p != '"') {
+        if (*p == '\\') *escaped = 1;
+        p += (*p == '\\') ? 2 : 1;
+    }
+    return p < end ? p : end;
+}
+
+/* api_skip_value: Returns the byte after the JSON value at p, with its
+    nested values, or end if the value is cut short. */
+static const char* api_skip_value(const char* p, const char* end) {
+    int depth = 0;
+    int escaped = 0;
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            p = api_skip_string(p + 1, end, &escaped);
+            if (p == end) return end;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0) return p;
+            depth--;
+        } else if (c == ',' && depth == 0) {
+            return p;
+        }
+        p++;
+        if (depth == 0 && (c == '"' || c == '}' || c == ']')) return p;
+    }
+    return end;
+}
+
+/* api_classify_object: Returns API_CLASS_CONTROL if the JSON object at p
+    names a command that changes the pyoneer, or, if batch is set, is a
+    batch with such a command in its commands array. Only the object's own
+    members are looked at, so command keys nested in other values don't
+    count. Escaped keys and names aren't decoded, and count as control. */
+static int api_classify_object(const char* p, const char* end, int batch) {
+    int control = 0;
+    int is_batch = 0;
+    int nested = 0;
+    p = api_skip_space(p, end);
+    if (p == end || *p != '{') return API_CLASS_READ;
+    p++;
+    while (1) {
+        p = api_skip_space(p, end);
+        if (p == end || *p != '"') break;
+        int escaped = 0;
+        const char* key = p + 1;
+        p = api_skip_string(key, end, &escaped);
+        if (p == end) break;
+        size_t klen = p - key;
+        p = api_skip_space(p + 1, end);
+        if (p == end || *p != ':') break;
+        p = api_skip_space(p + 1, end);
+        if (p == end) break;
+        if (escaped) control = 1;
+
+        if (klen == 7 && memcmp(key, "command", 7) == 0 && *p == '"') {
+            const char* name = p + 1;
+            const char* q = api_skip_string(name, end, &escaped);
+            int code = api_lookup(name, q - name);
+            if (escaped || (code != -1 && API_COMMANDS[code].control))
+                control = 1;
+            if (code == API_BATCH) is_batch = 1;
+        } else if (batch && klen == 8 && memcmp(key, "commands", 8) == 0 && *p == '[') {
+            const char* q = p + 1;
+            while (1) {
+                q = api_skip_space(q, end);
+                if (q == end || *q == ']') break;
+                if (api_classify_object(q, end, 0) == API_CLASS_CONTROL) nested = 1;
+                q = api_skip_space(api_skip_value(q, end), end);
+                if (q == end || *q != ',') break;
+                q++;
+            }
+        }
+
+        p = api_skip_space(api_skip_value(p, end), end);
+        if (p == end || *p != ',') break;
+        p++;
+    }
+    if (control || (is_batch && nested)) return API_CLASS_CONTROL;
+    return API_CLASS_READ;
+}
+
+/* api_classify: Returns the class of the request, API_CLASS_CONTROL if it
+    names a command that changes the pyoneer, or is a batch of commands
+    with one that does. The event loop can't afford to parse requests, so
+    the body is only scanned for the top level keys. */
+static int api_classify(const frame* f) {
+    return api_classify_object(f->body, f->body + f->len, 1);
+}
+
+/* api_bucket_take: Takes a token from the client's bucket for the class.
+    Returns 1 on success, and 0 if the client is over the class limit. */
+static int api_bucket_take(struct api_client* client, int cls, uint64_t now) {
+    const struct api_limit* limit = &client->server->limits[cls];
+    if (limit->rate == 0) return 1;
+
+    struct api_bucket* bucket = &client->buckets[cls];
+    bucket->tokens += (now - bucket->refilled) * limit->rate / 1e9;
+    if (bucket->tokens > limit->burst) bucket->tokens = limit->burst;
+    bucket->refilled = now;
+    if (bucket->tokens < 1) return 0;
+    bucket->tokens -= 1;
+    return 1;
+}
+
+/* api_client_dispatch: Hands the complete requests buffered on the client to
+    the handler pool. Requests over the client's rate limit are answered with
+    a throttled error, and cached requests from the cache, without the pool.
+    If the queue is full, the requests are answered with a busy error
+    instead. Returns 0 on success, and -1 if the client sent an invalid
+    frame or the connection failed. */
+static int api_client_dispatch(struct api_client* client) {
+    Api* server = client->server;
+    if (client->job || client->out->len > 0) return api_client_watch(client);
+
+    Buffer* in = client->in;
+    size_t off = 0;
+    frame f;
+    int rv;
+
+    // New requests aren't handled while the server drains, not even the
+    // cached ones
+    if (client->loop->draining) {
+        while ((rv = frame_next(in->data + off, in->len - off, &f)) == 1)
+            off += f.size;
+        if (rv == -1) {
+            atomic_fetch_add_explicit(&server->parse_errors, 1, memory_order_relaxed);
+            logger_info(server->logger, API_ERROR_MSG[API_ERR_FRAME]);
+            return -1;
+        }
+        int err = api_client_reject(client, in->data, off, API_ERR_SHUTTING_DOWN);
+        buffer_consume(in, off);
+        api_buffer_trim(in);
+        if (err == -1 || api_client_flush(client) == -1) return -1;
+        return api_client_watch(client);
+    }
+
+    // Answer the throttled and cached requests at the start of the buffer
+    uint64_t now = api_clock();
+    while ((rv = frame_next(in->data + off, in->len - off, &f)) == 1) {
+        int cls = api_classify(&f);
+        if (api_bucket_take(client, cls, now) == 0) {
+            atomic_fetch_add_explicit(&server->throttled, 1, memory_order_relaxed);
+            if (api_client_reject(client, in->data + off, f.size, API_ERR_THROTTLED) == -1)
+                return -1;
+            off += f.size;
+            continue;
+        }
+
+        int code;
+        int hit = api_cache_get(server, &f, client->out, &code);
+        if (hit == -1) return -1;
+        if (hit == 0) {
+            // Give the token back, the request is taken below
+            client->buckets[cls].tokens += 1;
+            break;
+        }
+        histogram_record(server->latency[code], api_clock() - client->recv_time);
+        off += f.size;
+    }
+    if (off > 0) {
+        buffer_consume(in, off);
+        api_buffer_trim(in);
+        if (api_client_flush(client) == -1) return -1;
+        off = 0;
+    }
+
+    // Find the complete requests at the start of the buffer within the
+    // client's limits, the rest wait for the responses to these
+    int cls = API_CLASS_READ;
+    while ((rv = frame_next(in->data + off, in->len - off, &f)) == 1) {
+        int c = api_classify(&f);
+        if (api_bucket_take(client, c, now) == 0) break;
+        if (c == API_CLASS_CONTROL) cls = c;
+        off += f.size;
+    }
+    if (rv == -1) {
+        atomic_fetch_add_explicit(&server->parse_errors, 1, memory_order_relaxed);
+        logger_info(server->logger, API_ERROR_MSG[API_ERR_FRAME]);
+        return -1;
+    }
+    if (off == 0) return api_client_watch(client);
+
+    // The client's spare job is reused, so only its first requests allocate
+    struct api_job* job = client->spare;
+    if (job == NULL && (job = api_job_create(client)) == NULL) return -1;
+    client->spare = NULL;
+    job->watch = (struct api_watch){0};
+    job->recv_time = client->recv_time;
+    job->cls = cls;
+
+    // Swap in the job's empty buffer, or copy the complete requests out
+    if (off == in->len) {
+        client->in = job->in;
+        job->in = in;
+    } else {
+        if (buffer_append(job->in, in->data, off) == -1) {
+            api_job_recycle(job);
+            return -1;
+        }
+        buffer_consume(in, off);
+        api_buffer_trim(in);
+    }
+
+    pthread_mutex_lock(&server->lock);
+    struct api_queue* queue = cls == API_CLASS_CONTROL ? &server->control : &server->queue;
+    int full = (queue->len >= API_QUEUELEN);
+    if (!full) {
+        api_queue_push(queue, job);
+        client->job = job;
+        pthread_cond_signal(&server->cond);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (full) {
+        logger_info(server->logger, API_ERROR_MSG[API_ERR_BUSY]);
+        int err = api_client_reject(client, job->in->data, job->in->len, API_ERR_BUSY);
+        api_job_recycle(job);
+        if (err == -1 || api_client_flush(client) == -1) return -1;
+    }
+    return api_client_watch(client);
+}
+
+/* api_client_read: Reads from the client and dispatches its complete
+    requests. Partial requests are kept on the client until the rest of
+    the request arrives. Returns 0 on success, and -1 if the client closed
+    the connection or failed. */
+static int api_client_read(struct api_client* client) {
+    Buffer* in = client->in;
+    if (buffer_reserve(in, BUFLEN) == -1) return -1;
+
+    ssize_t nbytes = recv(client->client_fd, in->data + in->len,
+        in->capacity - in->len - 1, 0);
+    if (nbytes == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        perror("api_client_read: recv");
+        return -1;
+    }
+    if (nbytes == 0) return -1;
+    in->len += nbytes;
+    client->recv_time = api_clock();
+
+    return api_client_dispatch(client);
+}
+
+/* api_client_write: Sends the client's pending responses and, once they
+    are sent, dispatches its buffered requests. Returns 0 on success, and
+    -1 if the connection failed. */
+static int api_client_write(struct api_client* client) {
+    if (api_client_flush(client) == -1) return -1;
+    if (client->out->len == 0 && client->in->len > 0)
+        return api_client_dispatch(client);
+    return api_client_watch(client);
+}
+
+
+/* api_watch_push: Pushes the pyoneer and blueprint statuses to the watching
+    clients they changed for. A client is skipped while its interval hasn't
+    elapsed or earlier messages are still unsent, so it only gets the latest
+    statuses. */
+static void api_watch_push(struct api_loop* loop) {
+    long now = api_now();
+    if (now < loop->watch_next) return;
+    loop->watch_next = now + API_WATCHTICK;
+
+    // Nothing to push if every watcher has the statuses of this version
+    Pyoneer* pyoneer = loop->server->pyoneer;
+    unsigned int version = 0;
+    if (pyoneer->get_version) {
+        version = pyoneer->get_version(pyoneer);
+        if (loop->watch_fresh && version == loop->watch_version) return;
+    }
+    int status = pyoneer->get_status(pyoneer);
+    int blueprint_status = pyoneer->get_blueprint_status(pyoneer);
+    int fresh = 1;
+
+    char* msg = NULL;
+    size_t len = 0;
+    struct api_client* client = loop->clients;
+    while (client) {
+        struct api_client* next = client->next;
+        struct api_watch* watch = &client->watch;
+        if (watch->on == 0 || (watch->status == status &&
+            watch->blueprint_status == blueprint_status)) {
+            client = next;
+            continue;
+        }
+        if (client->out->len > 0 || now - watch->pushed < watch->interval) {
+            fresh = 0;
+            client = next;
+            continue;
+        }
+
+        // Serialize the message once for all clients
+        if (msg == NULL) {
+            json_value* obj = json_object_new(0);
+            if (obj == NULL) {
+                loop->watch_fresh = 0;
+                return;
+            }
+            json_object_push(obj, "status", pyoneer_status_encode(status));
+            json_object_push(obj, "blueprint_status",
+                blueprint_status_encode(blueprint_status));
+            msg = malloc(json_measure(obj));
+            if (msg == NULL) {
+                perror("api_watch_push: malloc");
+                json_builder_free(obj);
+                loop->watch_fresh = 0;
+                return;
+            }
+            json_serialize(msg, obj);
+            json_builder_free(obj);
+            len = strlen(msg);
+        }
+
+        watch->status = status;
+        watch->blueprint_status = blueprint_status;
+        watch->pushed = now;
+        if (api_push_response(client->out, msg, len, watch->framed) == -1 ||
+            api_client_write(client) == -1)
+            api_remove_client(loop, client);
+        client = next;
+    }
+    free(msg);
+    loop->watch_fresh = fresh;
+    loop->watch_version = version;
+}
+
+/* api_complete: Sends the responses of the jobs the pool is done with. */
+static void api_complete(struct api_loop* loop) {
+    Api* server = loop->server;
+    uint64_t n;
+    if (read(loop->event_fd, &n, sizeof(n)) == -1 && errno != EAGAIN)
+        perror("api_complete: read");
+
+    pthread_mutex_lock(&server->lock);
+    struct api_queue done = loop->done;
+    loop->done = (struct api_queue){0};
+    pthread_mutex_unlock(&server->lock);
+
+    struct api_job* job;
+    while ((job = api_queue_pop(&done))) {
+        struct api_client* client = job->client;
+        client->job = NULL;
+        if (client->status == CLIENT_INACTIVE) {
+            api_job_recycle(job);
+            continue;
+        }
+
+        if (job->watch.on) {
+            if (client->watch.on == 0) loop->nwatchers++;
+            client->watch = job->watch;
+            client->watch.pushed = api_now();
+            loop->watch_fresh = 0;
+        }
+
+        // Take over the job's responses without copying them, unless
+        // status changes were pushed to the client in the meantime
+        int err = 0;
+        if (client->out->len > 0) {
+            err = buffer_append(client->out, job->out->data, job->out->len);
+        } else {
+            Buffer* out = client->out;
+            client->out = job->out;
+            job->out = out;
+        }
+        if (err == 0) err = api_client_flush(client);
+
+        // Record the latency of each request, now that they were sent, and
+        // recycle the job before the client's next requests are dispatched
+        uint64_t latency = api_clock() - job->recv_time;
+        for (size_t i = 0; i < job->codes->len; i++)
+            histogram_record(server->latency[(unsigned char)job->codes->data[i]], latency);
+        api_job_recycle(job);
+        if (err == -1 || api_client_write(client) == -1)
+            api_remove_client(loop, client);
+    }
+}
+
+/* api_accept: Accepts all pending client connections on the listening
+    socket. */
+static void api_accept(struct api_loop* loop, int listen_fd) {
+    while (1) {
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("api_accept: accept");
+            return;
+        }
+
+        if (fcntl(client_fd, F_SETFL, O_NONBLOCK) == -1) {
+            perror("api_accept: fcntl");
+            close(client_fd);
+            continue;
+        }
+
+        if (api_add_client(loop, client_fd) == NULL)
+            close(client_fd);
+    }
+}
+
+/* api_wake: Wakes up the loop if it's waiting for events. Safe to call
+    from any thread. */
+static void api_wake(struct api_loop* loop) {
+    uint64_t one = 1;
+    if (loop->event_fd != -1 && write(loop->event_fd, &one, sizeof(one)) == -1 &&
+        errno != EAGAIN)
+        perror("api_wake: write");
+}
+
+/* api_halt: Stops the event loops, each stops accepting connections and
+    drains the ones it has. Safe to call from any loop. */
+static void api_halt(Api* server) {
+    if (atomic_exchange(&server->halt, 1)) return;
+    atomic_store(&server->drain_start, api_now());
+    logger_info(server->logger, API_MSG[API_SERVER_DRAIN]);
+
+    for (int i = 0; i < server->nloops; i++)
+        api_wake(&server->loops[i]);
+}
+
+/* api_loop_drain: Stops accepting connections on the loop. Its connections
+    are closed once their in-flight requests are answered, or at the drain
+    deadline, and new requests are answered with a shutting down error. */
+static void api_loop_drain(struct api_loop* loop) {
+    loop->draining = 1;
+    loop->drain_deadline = api_now() + loop->server->drain_timeout;
+
+    // io_uring holds the sockets open until their requests are cancelled
+    if (loop->ring) {
+        if (loop->server_fd != -1) api_uring_cancel(loop, loop, API_OP_ACCEPT);
+        if (loop->tcp_fd != -1) api_uring_cancel(loop, loop, API_OP_ACCEPT_TCP);
+        if (loop->handoff_fd != -1) api_uring_cancel(loop, loop, API_OP_HANDOFF);
+        if (uring_submit(loop->ring, 0) == -1)
+            perror("api_loop_drain: io_uring_enter");
+    }
+    if (loop->server_fd != -1)
+        close(loop->server_fd);
+    loop->server_fd = -1;
+    if (loop->tcp_fd != -1)
+        close(loop->tcp_fd);
+    loop->tcp_fd = -1;
+    if (loop->handoff_fd != -1)
+        close(loop->handoff_fd);
+    loop->handoff_fd = -1;
+    if (loop->handoff_conn != -1)
+        close(loop->handoff_conn);
+    loop->handoff_conn = -1;
+}
+
+/* api_uring_accept: Forward declaration for api_loop_resume. */
+static int api_uring_accept(struct api_loop* loop, int listen_fd, int op);
+
+/* api_loop_paused: Counts the loop out of the loops yet to pause, and
+    wakes up the first loop once none are left. */
+static void api_loop_paused(struct api_loop* loop) {
+    Api* server = loop->server;
+    if (atomic_fetch_sub(&server->accepting, 1) == 1)
+        api_wake(&server->loops[0]);
+}
+
+/* api_loop_pause: Stops accepting connections on the loop's listening
+    sockets without closing them. io_uring accepts are cancelled, and the
+    loop is paused once their last completions arrive, so no connection is
+    accepted after the sockets are handed off. */
+static void api_loop_pause(struct api_loop* loop) {
+    loop->paused = 1;
+    if (loop->ring) {
+        if (loop->server_fd != -1) api_uring_cancel(loop, loop, API_OP_ACCEPT);
+        if (loop->tcp_fd != -1) api_uring_cancel(loop, loop, API_OP_ACCEPT_TCP);
+        if (loop->accepts > 0) return;
+    } else {
+        int fds[] = {loop->server_fd, loop->tcp_fd};
+        for (size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); i++)
+            if (fds[i] != -1 && epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fds[i], NULL) == -1)
+                perror("api_loop_pause: epoll_ctl");
+    }
+    api_loop_paused(loop);
+}
+
+/* api_loop_resume: Accepts connections on the loop's listening sockets
+    again after a failed handoff. Returns 0 on success, and -1 otherwise. */
+static int api_loop_resume(struct api_loop* loop) {
+    loop->paused = 0;
+    int* fds[] = {&loop->server_fd, &loop->tcp_fd};
+    int ops[] = {API_OP_ACCEPT, API_OP_ACCEPT_TCP};
+    for (size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); i++) {
+        if (*fds[i] == -1) continue;
+        if (loop->ring) {
+            if (api_uring_accept(loop, *fds[i], ops[i]) == -1) return -1;
+            continue;
+        }
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = fds[i];
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, *fds[i], &ev) == -1) {
+            perror("api_loop_resume: epoll_ctl");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* api_loop_drained: Returns 1 once none of the draining loop's connections
+    have requests in flight or unsent responses, or once the drain deadline
+    passed. Otherwise, returns 0. */
+static int api_loop_drained(struct api_loop* loop) {
+    struct api_client* client = loop->clients;
+    while (client && client->job == NULL && client->out->len == 0 &&
+        client->sending == 0)
+        client = client->next;
+    if (client == NULL) return 1;
+
+    if (api_now() < loop->drain_deadline) return 0;
+    logger_info(loop->server->logger, API_MSG[API_DRAIN_TIMEOUT]);
+    return 1;
+}
+
+/* api_handoff_send: Forward declaration for api_loop_step. */
+static void api_handoff_send(struct api_loop* loop);
+
+/* api_loop_step: Starts draining the loop once the server halts, and returns
+    the ms the loop can wait for events, -1 for no limit, or -2 once the
+    loop is drained and its connections are closed. */
+static int api_loop_step(struct api_loop* loop) {
+    Api* server = loop->server;
+    if (loop->draining == 0 && (sig_flag == 1 || atomic_load(&server->halt))) {
+        api_halt(server);
+        api_loop_drain(loop);
+    }
+    if (loop->draining && api_loop_drained(loop)) {
+        while (loop->clients)
+            api_remove_client(loop, loop->clients);
+        return -2;
+    }
+
+    // Pause accepting while a handoff waits, the first loop hands off the
+    // sockets once every loop is paused
+    if (loop->draining == 0 && loop->paused != atomic_load(&server->handing_off)) {
+        if (loop->paused == 0)
+            api_loop_pause(loop);
+        else if (api_loop_resume(loop) == -1)
+            api_halt(server);
+    }
+    if (loop->handoff_conn != -1 && atomic_load(&server->accepting) == 0)
+        api_handoff_send(loop);
+
+    // Wake up to check the statuses while clients are watching them
+    int timeout = loop->nwatchers > 0 ? API_WATCHTICK : -1;
+    if (loop->draining) {
+        long left = loop->drain_deadline - api_now();
+        if (left < 0) left = 0;
+        if (timeout == -1 || left < timeout) timeout = left;
+    }
+    return timeout;
+}
+
+/* api_handoff: Takes the connection of a pyoneer asking for the listening
+    sockets, and pauses accepting on every loop until they are handed
+    off. */
+static void api_handoff(struct api_loop* loop) {
+    Api* server = loop->server;
+    int fd = accept(loop->handoff_fd, NULL, NULL);
+    if (fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            perror("api_handoff: accept");
+        return;
+    }
+    if (loop->handoff_conn != -1) {
+        close(fd);
+        return;
+    }
+
+    loop->handoff_conn = fd;
+    atomic_store(&server->accepting, server->nloops);
+    atomic_store(&server->handing_off, 1);
+    for (int i = 0; i < server->nloops; i++)
+        api_wake(&server->loops[i]);
+}
+
+/* api_handoff_send: Hands copies of the listening sockets to the waiting
+    pyoneer, local socket first, and halts the server. The sockets keep
+    listening in the new pyoneer, so no connection is refused while this
+    one drains. If the sockets can't be sent, the loops accept again. */
+static void api_handoff_send(struct api_loop* loop) {
+    Api* server = loop->server;
+    int fds[1 + API_MAXLOOPS];
+    int n = 0;
+    fds[n++] = loop->server_fd;
+    for (int i = 0; i < server->nloops; i++)
+        if (server->loops[i].tcp_fd != -1)
+            fds[n++] = server->loops[i].tcp_fd;
+    int err = net_send_fds(loop->handoff_conn, fds, n);
+    close(loop->handoff_conn);
+    loop->handoff_conn = -1;
+    if (err == -1) {
+        atomic_store(&server->handing_off, 0);
+        for (int i = 0; i < server->nloops; i++)
+            api_wake(&server->loops[i]);
+        return;
+    }
+
+    logger_info(server->logger, API_MSG[API_HANDOFF]);
+    api_halt(server);
+}
+
+/* api_epoll_init: Creates the epoll instance and registers the loop's
+    listening sockets and event fd with it. Returns 0 on success, and -1
+    otherwise. */
+static int api_epoll_init(struct api_loop* loop) {
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd == -1) {
+        perror("api_epoll_init: epoll_create1");
+        return -1;
+    }
+
+    // The listening sockets and the event fd are tagged with their fields
+    int* fds[] = {&loop->server_fd, &loop->tcp_fd, &loop->handoff_fd, &loop->event_fd};
+    for (size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); i++) {
+        if (*fds[i] == -1) continue;
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = fds[i];
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, *fds[i], &ev) == -1) {
+            perror("api_epoll_init: epoll_ctl");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* api_epoll_loop: Serves client connections until the process encounters
+    an interupt or the server stops, and the connections are drained.
+    Returns 0 on interupt, and -1 otherwise. */
+static int api_epoll_loop(struct api_loop* loop) {
+    struct epoll_event events[MAXEVENTS];
+    int timeout;
+    while ((timeout = api_loop_step(loop)) != -2) {
+        int n = epoll_wait(loop->epoll_fd, events, MAXEVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("api_epoll_loop: epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &loop->server_fd || ptr == &loop->tcp_fd) {
+                api_accept(loop, *(int*)ptr);
+                continue;
+            }
+            if (ptr == &loop->handoff_fd) {
+                api_handoff(loop);
+                continue;
+            }
+            if (ptr == &loop->event_fd) {
+                api_complete(loop);
+                continue;
+            }
+
+            struct api_client* client = ptr;
+            if (client->status == CLIENT_INACTIVE) continue;
+
+            int err = 0;
+            if (events[i].events & EPOLLOUT)
+                err = api_client_write(client);
+            else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                err = api_client_read(client);
+
+            if (err == -1)
+                api_remove_client(loop, client);
+        }
+        if (loop->nwatchers > 0) api_watch_push(loop);
+        api_reap_clients(loop);
+    }
+    return 0;
+}
+
+/* api_uring_accept: Arms a multishot accept on the listening socket, the
+    op tells the completions of each socket apart. Returns 0 on success, and
+    -1 otherwise. */
+static int api_uring_accept(struct api_loop* loop, int listen_fd, int op) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop->ring);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uintptr_t)loop | op;
+    loop->accepts++;
+    return 0;
+}
+
+/* api_uring_poll: Arms a multishot poll on the event fd or the handoff
+    socket, the op tells them apart. Returns 0 on success, and -1
+    otherwise. */
+static int api_uring_poll(struct api_loop* loop, int fd, int op) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop->ring);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uintptr_t)loop | op;
+    return 0;
+}
+
+/* api_uring_init: Creates the io_uring instance and its provided buffers,
+    and arms the accept and event fd requests. Returns 0 on success, and -1
+    if the kernel doesn't support them. */
+static int api_uring_init(struct api_loop* loop) {
+    loop->ring = uring_create(API_URINGLEN, API_URING_CQLEN);
+    if (loop->ring == NULL) return -1;
+
+    if (uring_buffers_create(loop->ring, API_URING_BGID, API_URING_BUFS, BUFLEN) == -1 ||
+        (loop->server_fd != -1 &&
+         api_uring_accept(loop, loop->server_fd, API_OP_ACCEPT) == -1) ||
+        (loop->tcp_fd != -1 &&
+         api_uring_accept(loop, loop->tcp_fd, API_OP_ACCEPT_TCP) == -1) ||
+        (loop->handoff_fd != -1 &&
+         api_uring_poll(loop, loop->handoff_fd, API_OP_HANDOFF) == -1) ||
+        api_uring_poll(loop, loop->event_fd, API_OP_EVENT) == -1 ||
+        uring_submit(loop->ring, 0) == -1) {
+        uring_destroy(loop->ring);
+        loop->ring = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* api_uring_recv_done: Appends the received bytes to the client's requests
+    and dispatches them. Returns 0 on success, and -1 if the client closed
+    the connection or failed. */
+static int api_uring_recv_done(struct api_loop* loop, struct api_client* client,
+    const struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) client->receiving = 0;
+
+    int err = 0;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && client->status == CLIENT_ACTIVE) {
+            err = buffer_append(client->in, uring_buffer(loop->ring, bid), cqe->res);
+            client->recv_time = api_clock();
+        }
+        uring_buffer_return(loop->ring, bid);
+    }
+    if (client->status == CLIENT_INACTIVE) return 0;
+    if (err == -1) return -1;
+
+    // Rearm the receive once the kernel ran out of buffers, or once the
+    // client is idle again after it was cancelled
+    if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED)
+        return api_client_watch(client);
+    if (cqe->res <= 0) {
+        if (cqe->res < 0)
+            fprintf(stderr, "api_uring_recv_done: recv: %s\n", strerror(-cqe->res));
+        return -1;
+    }
+    return api_client_dispatch(client);
+}
+
+/* api_uring_send_done: Drops the sent bytes and sends the rest of the
+    client's responses. Returns 0 on success, and -1 if the connection
+    failed. */
+static int api_uring_send_done(struct api_loop* loop, struct api_client* client,
+    const struct io_uring_cqe* cqe) {
+    client->sending = 0;
+    if (client->status == CLIENT_INACTIVE) return 0;
+    if (cqe->res < 0) {
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+            return api_uring_send(loop, client);
+        fprintf(stderr, "api_uring_send_done: send: %s\n", strerror(-cqe->res));
+        return -1;
+    }
+
+    buffer_consume(client->sent, cqe->res);
+    api_buffer_trim(client->sent);
+    if (client->sent->len > 0)
+        return api_uring_send(loop, client);
+    return api_client_write(client);
+}
+
+/* api_uring_loop: Serves client connections with io_uring until the process
+    encounters an interupt or the server stops, and the connections are
+    drained. Accepts and receives are multishot requests, and all requests
+    queued while handling a batch of completions are submitted with one
+    system call. Returns 0 on interupt, and -1 otherwise. */
+static int api_uring_loop(struct api_loop* loop) {
+    Uring* ring = loop->ring;
+    int timeout;
+    while ((timeout = api_loop_step(loop)) != -2) {
+        if (uring_submit(ring, timeout) == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            perror("api_uring_loop: io_uring_enter");
+            return -1;
+        }
+
+        struct io_uring_cqe* next;
+        while ((next = uring_peek(ring))) {
+            struct io_uring_cqe cqe = *next;
+            uring_advance(ring);
+
+            int op = cqe.user_data & API_OP_MASK;
+            void* ptr = (void*)(uintptr_t)(cqe.user_data & ~(uint64_t)API_OP_MASK);
+            int more = cqe.flags & IORING_CQE_F_MORE;
+            if (op == API_OP_CANCEL) continue;
+            if (op == API_OP_ACCEPT || op == API_OP_ACCEPT_TCP) {
+                // A handoff pauses the accepts before the sockets are handed
+                // off, so only a drain without one turns connections away
+                if (cqe.res >= 0) {
+                    if (loop->draining || api_add_client(loop, cqe.res) == NULL)
+                        close(cqe.res);
+                } else if (cqe.res != -ECANCELED) {
+                    fprintf(stderr, "api_uring_loop: accept: %s\n", strerror(-cqe.res));
+                }
+                if (!more) {
+                    loop->accepts--;
+                    int listen_fd = op == API_OP_ACCEPT ? loop->server_fd : loop->tcp_fd;
+                    if (!loop->draining && !loop->paused &&
+                        api_uring_accept(loop, listen_fd, op) == -1)
+                        return -1;
+                    if (loop->paused && loop->accepts == 0 && !loop->draining)
+                        api_loop_paused(loop);
+                }
+            } else if (op == API_OP_EVENT) {
+                api_complete(loop);
+                if (!more && api_uring_poll(loop, loop->event_fd, op) == -1)
+                    return -1;
+            } else if (op == API_OP_HANDOFF) {
+                if (cqe.res >= 0 && !loop->draining) api_handoff(loop);
+                if (!more && !loop->draining &&
+                    api_uring_poll(loop, loop->handoff_fd, op) == -1)
+                    return -1;
+            } else {
+                struct api_client* client = ptr;
+                int err;
+                if (op == API_OP_RECV)
+                    err = api_uring_recv_done(loop, client, &cqe);
+                else
+                    err = api_uring_send_done(loop, client, &cqe);
+                if (err == -1)
+                    api_remove_client(loop, client);
+            }
+        }
+        if (loop->nwatchers > 0) api_watch_push(loop);
+        api_reap_clients(loop);
+    }
+    return 0;
+}
+
+/* api_loop_init: Creates the loop's event fd and its io_uring instance or,
+    as the fallback, its epoll instance. Returns 0 on success, and -1
+    otherwise. */
+static int api_loop_init(struct api_loop* loop) {
+    Api* server = loop->server;
+    loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->event_fd == -1) {
+        perror("api_loop_init: eventfd");
+        return -1;
+    }
+
+    if (server->backend == API_BACKEND_URING && api_uring_init(loop) == -1)
+        logger_info(server->logger, API_MSG[API_URING_FALLBACK]);
+    if (loop->ring == NULL && api_epoll_init(loop) == -1)
+        return -1;
+    return 0;
+}
+
+/* api_loop_run: Runs the loop with the backend it was created with. */
+static int api_loop_run(struct api_loop* loop) {
+    if (loop->ring)
+        return api_uring_loop(loop);
+    return api_epoll_loop(loop);
+}
+
+/* api_loop_thread: Runs a listener thread's event loop until the server
+    stops. */
+static void* api_loop_thread(void* arg) {
+    struct api_loop* loop = arg;
+    if (api_loop_run(loop) == -1)
+        logger_info(loop->server->logger, API_ERROR_MSG[API_ERR_INTERNAL]);
+    return NULL;
+}
+
+/* api_loop_destroy: Closes the loop's connections and frees its
+    resources. */
+static void api_loop_destroy(struct api_loop* loop) {
+    struct api_job* job;
+    while ((job = api_queue_pop(&loop->done))) {
+        job->client->job = NULL;
+        api_job_destroy(job);
+    }
+
+    while (loop->clients)
+        api_remove_client(loop, loop->clients);
+
+    // Closing the ring cancels its requests
+    if (loop->ring) {
+        uring_destroy(loop->ring);
+        loop->ring = NULL;
+        for (struct api_client* client = loop->closed; client; client = client->next) {
+            client->receiving = 0;
+            client->sending = 0;
+        }
+    }
+    api_reap_clients(loop);
+
+    int* fds[] = {&loop->event_fd, &loop->epoll_fd, &loop->server_fd, &loop->tcp_fd,
+        &loop->handoff_fd, &loop->handoff_conn};
+    for (size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); i++) {
+        if (*fds[i] != -1)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+/* api_set_tcp: Sets the "host:port" address the server also listens on
+    once it starts, or NULL for the local socket only. Returns 0 on success,
+    and -1 otherwise. */
+int api_set_tcp(Api* server, const char* addr) {
+    char* copy = NULL;
+    if (addr && (copy = strdup(addr)) == NULL) {
+        perror("api_set_tcp: strdup");
+        return -1;
+    }
+    free(server->tcp_addr);
+    server->tcp_addr = copy;
+    return 0;
+}
+
+/* api_set_listeners: Sets the number of listener threads the server starts
+    when it listens on TCP. Each thread has its own SO_REUSEPORT socket and
+    event loop, and the kernel spreads new connections across them. Returns
+    0 on success, and -1 if n is out of range. */
+int api_set_listeners(Api* server, int n) {
+    if (n < 1 || n > API_MAXLOOPS) {
+        fprintf(stderr, "api_set_listeners: Error: Invalid number of listeners %d\n", n);
+        return -1;
+    }
+    server->nlisteners = n;
+    return 0;
+}
+
+/* api_set_drain_timeout: Sets the ms the server waits for in-flight
+    requests when it stops, before it closes the connections anyway. Returns
+    0 on success, and -1 if ms is negative. */
+int api_set_drain_timeout(Api* server, long ms) {
+    if (ms < 0) {
+        fprintf(stderr, "api_set_drain_timeout: Error: Invalid timeout %ld\n", ms);
+        return -1;
+    }
+    server->drain_timeout = ms;
+    return 0;
+}
+
+/* api_set_rate_limit: Limits each connection to rate requests per second
+    of the class, with bursts of up to burst requests. Requests over the
+    limit are answered with a throttled error. A rate of 0 removes the
+    limit. Returns 0 on success, and -1 if the limit is invalid. */
+int api_set_rate_limit(Api* server, ApiClass cls, double rate, double burst) {
+    if (cls < 0 || cls >= API_NCLASSES || rate < 0 || (rate > 0 && burst < 1)) {
+        fprintf(stderr, "api_set_rate_limit: Error: Invalid rate limit\n");
+        return -1;
+    }
+    server->limits[cls].rate = rate;
+    server->limits[cls].burst = burst;
+    return 0;
+}
+
+/* api_set_backend: Sets the socket I/O backend the server uses once it
+    starts. If the io_uring backend isn't supported by the kernel, the server
+    falls back to epoll. */
+void api_set_backend(Api* server, ApiBackend backend) {
+    server->backend = backend;
+}
+
+/* api_listen_local: Creates a local socket listening on the path and
+    returns it. Otherwise, returns -1. */
+static int api_listen_local(const char* path) {
+    int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("api_listen_local: socket");
+        return -1;
+    }
+
+    if (unlink(path) == -1 && errno != ENOENT) {
+        perror("api_listen_local: unlink");
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_LOCAL;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("api_listen_local: bind");
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, BACKLOG) == -1) {
+        perror("api_listen_local: listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* api_inherit: Takes over the listening sockets of the pyoneer listening on
+    the handoff socket, if there is one. Returns the number of sockets
+    received, the local socket first, or 0 if there is no pyoneer to take
+    over from. Otherwise, returns -1. */
+static int api_inherit(Api* server, int* fds, int max) {
+    net_addr addr;
+    if (net_addr_unix(&addr, server->handoff_path) == -1) return -1;
+
+    int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("api_inherit: socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr.ss, addr.len) == -1) {
+        int err = errno;
+        close(fd);
+        if (err == ENOENT || err == ECONNREFUSED) return 0;
+        errno = err;
+        perror("api_inherit: connect");
+        return -1;
+    }
+
+    int n = net_recv_fds(fd, fds, max);
+    close(fd);
+    if (n > 0) logger_info(server->logger, API_MSG[API_INHERIT]);
+    return n;
+}
+
+/* api_set_handoff: Sets the local socket path the server hands its
+    listening sockets over on, or NULL to disable hot restarts. Once it
+    starts, the server takes over the sockets of the pyoneer listening on
+    the path, if there is one, and then listens on the path itself. Returns
+    0 on success, and -1 otherwise. */
+int api_set_handoff(Api* server, const char* path) {
+    char* copy = NULL;
+    if (path && (copy = strdup(path)) == NULL) {
+        perror("api_set_handoff: strdup");
+        return -1;
+    }
+    free(server->handoff_path);
+    server->handoff_path = copy;
+    return 0;
+}
+
+/* api_start: Creates a local socket, and a TCP socket if one is set, and
+    serves client connections from an event loop, while a fixed pool of
+    threads handles the requests. With more than one listener, each listener
+    thread runs its own event loop on its own TCP socket, and the first loop
+    also serves the local socket. On a hot restart, the sockets are taken
+    over from the old pyoneer instead, one loop per TCP socket. If the
+    process encounters an interupt, the server stops listening for new
+    client connections and returns 0. Otherwise, returns -1. */
+int api_start(Api* server) {
+    if (server == NULL) return -1;
+
+    int fds[1 + API_MAXLOOPS];
+    int ninherited = 0;
+    if (server->handoff_path) {
+        ninherited = api_inherit(server, fds, 1 + API_MAXLOOPS);
+        if (ninherited == -1) return -1;
+    }
+
+    // The local socket can't be shared, so it only gets one loop
+    int nloops = server->tcp_addr ? server->nlisteners : 1;
+    if (ninherited > 1) nloops = ninherited - 1;
+    server->loops = calloc(nloops, sizeof(struct api_loop));
+    if (server->loops == NULL) {
+        perror("api_start: calloc");
+        for (int i = 0; i < ninherited; i++)
+            close(fds[i]);
+        return -1;
+    }
+    server->nloops = nloops;
+    atomic_store(&server->halt, 0);
+    atomic_store(&server->handing_off, 0);
+    for (int i = 0; i < nloops; i++) {
+        struct api_loop* loop = &server->loops[i];
+        loop->server = server;
+        loop->server_fd = -1;
+        loop->tcp_fd = -1;
+        loop->handoff_fd = -1;
+        loop->handoff_conn = -1;
+        loop->epoll_fd = -1;
+        loop->event_fd = -1;
+    }
+
+    // Take over or create sockets, accepted TCP sockets inherit TCP_NODELAY
+    struct api_loop* first = &server->loops[0];
+    if (ninherited > 0)
+        first->server_fd = fds[0];
+    else
+        first->server_fd = api_listen_local(server->socket_path);
+    for (int i = 0; i + 1 < ninherited; i++)
+        server->loops[i].tcp_fd = fds[i + 1];
+
+    int listen_tcp = server->tcp_addr && ninherited <= 1;
+    for (int i = 0; listen_tcp && i < nloops && first->server_fd != -1; i++) {
+        server->loops[i].tcp_fd = net_listen_tcp(server->tcp_addr, BACKLOG, nloops > 1);
+        if (server->loops[i].tcp_fd == -1) break;
+    }
+    if (first->server_fd == -1 || (listen_tcp && server->loops[nloops - 1].tcp_fd == -1)) {
+        api_stop(server);
+        return -1;
+    }
+
+    if (server->handoff_path) {
+        first->handoff_fd = api_listen_local(server->handoff_path);
+        if (first->handoff_fd == -1) {
+            api_stop(server);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < nloops; i++) {
+        if (api_loop_init(&server->loops[i]) == -1) {
+            api_stop(server);
+            return -1;
+        }
+    }
+
+    // Start handler pool and listener threads, signals are left to the
+    // first event loop's thread
+    sigset_t mask, old;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    server->stopping = 0;
+    for (int i = 0; i < API_NTHREADS; i++) {
+        int err = pthread_create(&server->threads[i], NULL, api_worker_thread, server);
+        if (err != 0) {
+            fprintf(stderr, "api_start: pthread_create: %s\n", strerror(err));
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            api_stop(server);
+            return -1;
+        }
+        server->nthreads++;
+    }
+    for (int i = 1; i < nloops; i++) {
+        struct api_loop* loop = &server->loops[i];
+        int err = pthread_create(&loop->tid, NULL, api_loop_thread, loop);
+        if (err != 0) {
+            fprintf(stderr, "api_start: pthread_create: %s\n", strerror(err));
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            api_stop(server);
+            return -1;
+        }
+        loop->running = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    logger_info(server->logger, API_MSG[API_SERVER_START]);
+    logger_debug(server->logger, server->socket_path);
+    if (server->tcp_addr)
+        logger_debug(server->logger, server->tcp_addr);
+    if (server->handoff_path)
+        logger_debug(server->logger, server->handoff_path);
+
+    return api_loop_run(&server->loops[0]);
+}
+
+/* api_stop: Stops the server and frees all resources, and returns 0. */
+int api_stop(Api* server) {
+    if (server == NULL) return 0;
+    logger_info(server->logger, API_MSG[API_SERVER_STOP]);
+
+    // Stop listener threads, they drain their connections first
+    api_halt(server);
+    for (int i = 0; i < server->nloops; i++) {
+        struct api_loop* loop = &server->loops[i];
+        if (loop->running == 0) continue;
+        int err = pthread_join(loop->tid, NULL);
+        if (err != 0)
+            fprintf(stderr, "api_stop: pthread_join: %s\n", strerror(err));
+        loop->running = 0;
+    }
+
+    long start = atomic_exchange(&server->drain_start, 0);
+    if (start && server->nloops > 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "API: drained in %ld ms", api_now() - start);
+        logger_info(server->logger, msg);
+    }
+
+    // Stop handler pool, the running jobs finish first
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->cond);
+    pthread_mutex_unlock(&server->lock);
+
+    for (int i = 0; i < server->nthreads; i++) {
+        int err = pthread_join(server->threads[i], NULL);
+        if (err != 0)
+            fprintf(stderr, "api_stop: pthread_join: %s\n", strerror(err));
+    }
+    server->nthreads = 0;
+
+    // Drop queued jobs, then the finished jobs and clients of each loop
+    struct api_job* job;
+    while ((job = api_queue_pop(&server->control)) ||
+        (job = api_queue_pop(&server->queue))) {
+        job->client->job = NULL;
+        api_job_destroy(job);
+    }
+
+    for (int i = 0; i < server->nloops; i++)
+        api_loop_destroy(&server->loops[i]);
+    free(server->loops);
+    server->loops = NULL;
+    server->nloops = 0;
     return 0;
 }
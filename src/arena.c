@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#include "arena.h"
+
+// Each allocation is prefixed with its size, so it can be reallocated
+#define ARENA_ALIGN alignof(max_align_t)
+#define ARENA_HEADER ARENA_ALIGN
+
+/* arena_block_create: Creates a new block with room for size bytes. */
+static arena_block* arena_block_create(size_t size) {
+    arena_block* block = malloc(sizeof(arena_block) + size);
+    if (block == NULL) {
+        perror("arena_block_create: malloc");
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/* arena_create: Creates a new arena that allocates memory in blocks of at
+    least block_size bytes. */
+Arena* arena_create(size_t block_size) {
+    Arena* arena = malloc(sizeof(Arena));
+    if (arena == NULL) {
+        perror("arena_create: malloc");
+        return NULL;
+    }
+
+    arena->block_size = block_size;
+    arena->total = 0;
+    arena->head = arena_block_create(block_size);
+    if (arena->head == NULL) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+/* arena_destroy: Frees the arena and all of its blocks. */
+void arena_destroy(Arena* arena) {
+    if (arena == NULL) return;
+    arena_block* curr = arena->head;
+    while (curr) {
+        arena_block* next = curr->next;
+        free(curr);
+        curr = next;
+    }
+    free(arena);
+}
+
+/* arena_alloc: Allocates size bytes from the arena and returns a pointer to
+    them. If zero is set, the bytes are zeroed. Otherwise, returns NULL. */
+void* arena_alloc(Arena* arena, size_t size, int zero) {
+    size_t need = ARENA_HEADER + (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    arena_block* block = arena->head;
+    if (block->size - block->used < need) {
+        size_t len = (need > arena->block_size) ? need : arena->block_size;
+        block = arena_block_create(len);
+        if (block == NULL) return NULL;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    char* ptr = block->data + block->used;
+    block->used += need;
+    arena->total += need;
+    memcpy(ptr, &size, sizeof(size_t));
+    ptr += ARENA_HEADER;
+    if (zero) memset(ptr, 0, size);
+    return ptr;
+}
+
+/* arena_realloc: Grows the allocation to size bytes. The old bytes are
+    only reclaimed on reset. */
+void* arena_realloc(Arena* arena, void* ptr, size_t size) {
+    if (ptr == NULL) return arena_alloc(arena, size, 0);
+
+    size_t old;
+    memcpy(&old, (char*)ptr - ARENA_HEADER, sizeof(size_t));
+    if (size <= old) return ptr;
+
+    void* new = arena_alloc(arena, size, 0);
+    if (new == NULL) return NULL;
+    memcpy(new, ptr, old);
+    return new;
+}
+
+/* arena_reset: Frees everything allocated from the arena. If the last use
+    needed more than one block, the blocks are merged into one block large
+    enough for it, so the same use doesn't allocate again. */
+void arena_reset(Arena* arena) {
+    if (arena->head->next) {
+        size_t size = arena->total;
+        if (size > ARENA_MAXKEEP) size = ARENA_MAXKEEP;
+        if (size < arena->block_size) size = arena->block_size;
+
+        arena_block* block = arena_block_create(size);
+        if (block) {
+            arena_block* curr = arena->head;
+            while (curr) {
+                arena_block* next = curr->next;
+                free(curr);
+                curr = next;
+            }
+            arena->head = block;
+        }
+    }
+    arena->head->used = 0;
+    arena->total = 0;
+}
+
+/* arena_mem_alloc: Allocator callback for json_settings.mem_alloc. */
+void* arena_mem_alloc(size_t size, int zero, void* user_data) {
+    return arena_alloc(user_data, size, zero);
+}
+
+/* arena_mem_realloc: Allocator callback for json_builder_settings. */
+void* arena_mem_realloc(void* ptr, size_t size, void* user_data) {
+    return arena_realloc(user_data, ptr, size);
+}
+
+/* arena_mem_free: Allocator callback, arena memory is freed on reset. */
+void arena_mem_free(void* ptr, void* user_data) {
+    (void)ptr;
+    (void)user_data;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+/* buffer_create: Creates a new buffer with the given capacity. If the
+    capacity is 0, no memory is allocated until the first append. */
+Buffer* buffer_create(size_t capacity) {
+    Buffer* buffer = malloc(sizeof(Buffer));
+    if (buffer == NULL) {
+        perror("buffer_create: malloc");
+        return NULL;
+    }
+
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+    if (capacity > 0 && buffer_reserve(buffer, capacity) == -1) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/* buffer_destroy: Frees the buffer and its contents. */
+void buffer_destroy(Buffer* buffer) {
+    if (buffer == NULL) return;
+    free(buffer->data);
+    free(buffer);
+}
+
+/* buffer_reserve: Grows the buffer so that len more bytes (and a
+    terminator) fit after its contents. Returns 0 on success, and -1
+    otherwise. */
+int buffer_reserve(Buffer* buffer, size_t len) {
+    size_t need = buffer->len + len + 1;
+    if (need <= buffer->capacity) return 0;
+
+    size_t capacity = (buffer->capacity > 0) ? buffer->capacity : 64;
+    while (capacity < need)
+        capacity *= 2;
+
+    char* data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+        perror("buffer_reserve: realloc");
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+/* buffer_append: Appends len bytes to the end of the buffer. Returns 0 on
+    success, and -1 otherwise. */
+int buffer_append(Buffer* buffer, const char* data, size_t len) {
+    if (buffer_reserve(buffer, len) == -1) return -1;
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return 0;
+}
+
+/* buffer_consume: Removes the first len bytes from the buffer. If the
+    buffer is emptied, it keeps its memory for reuse, like buffer_clear. */
+void buffer_consume(Buffer* buffer, size_t len) {
+    if (len >= buffer->len) {
+        buffer->len = 0;
+        return;
+    }
+    memmove(buffer->data, buffer->data + len, buffer->len - len);
+    buffer->len -= len;
+}
+
+/* buffer_clear: Empties the buffer and keeps its memory for reuse. */
+void buffer_clear(Buffer* buffer) {
+    buffer->len = 0;
+}
+
+/* buffer_release: Empties the buffer and frees its memory. */
+void buffer_release(Buffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+}
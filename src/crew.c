@@ -1,13 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
-#include <sys/un.h>
 #include "crew.h"
-
-#define BUFLEN 1024
+#include "frame.h"
+#include "net.h"
 
 // Api commands
 static enum {
@@ -25,60 +31,7 @@ static const char* const CMD_API_JSON[] = {
     [CMD_UNASSIGN]              = "{\"command\":\"unassign\"}"
 };
 
-/* send_command: Sends a command to the worker and returns its response. */
-static json_value* send_command(Worker *worker, json_value *cmd) {
-    int sockfd, nbytes;
-    if ((sockfd = socket(AF_LOCAL, SOCK_STREAM, 0)) == -1) {
-        perror("crew: send_command: socket");
-        return NULL;
-    }
-
-    // Connect to the worker
-    struct sockaddr_un addr = {0};
-    addr.sun_family = AF_LOCAL;
-
-    // TODO: do something better please (':
-    char* dir = getenv("PYONEER_DIR");
-    int size = sizeof(addr.sun_path);
-    char* fmt[size];
-    char* end = stpncpy(fmt, dir, size);
-    stpncpy(end, "/worker%d.sock", size);
-    snprintf(addr.sun_path, size, fmt, worker->id);
-
-    if (connect(sockfd, &addr, sizeof(addr)) == -1) {
-        perror("crew: send_command: connect");
-        return NULL;
-    }
-
-    // Send command
-    char buf[BUFLEN];
-    if (json_measure(cmd) > BUFLEN) {
-        fprintf(stderr, "crew: send_command: Error: Serialized command to large for buffer\n");
-        close(sockfd);
-        return NULL;
-    }
-    json_serialize(buf, cmd);
-
-    if (send(sockfd, buf, strlen(buf), 0) == -1) {
-        perror("crew: send_command: send");
-        close(sockfd);
-        return NULL;
-    }
-
-    // Return response
-    if ((nbytes = recv(sockfd, buf, BUFLEN, 0)) == -1) {
-        perror("crew: send_command: recv");
-        exit(EXIT_FAILURE);
-    }
-    buf[nbytes >= BUFLEN ? BUFLEN - 1 : nbytes] = '\0'; 
-
-    json_value *res;
-    if ((res = json_parse(buf, strlen(buf))) == NULL) {
-        fprintf(stderr, "crew: send_comand: Error: Unable to parse response\n");
-    }
-    close(sockfd);
-    return res;
-}
+static const char* const CREW_STOP = "{\"command\":\"stop\"}";
 
 /* mutex_lock: Locks the mutex lock. If there is a system failure, mutex_lock
     prints a error message and exits the process. */
@@ -102,428 +55,1031 @@ static void mutex_unlock(pthread_mutex_t *lock, char *name) {
     return;
 }
 
-/* crew_worker_create: Creates a new worker. */
-static crew_worker* crew_worker_create(int id) {
+/* mutex_trylock: Locks the mutex lock, unless it is already locked.
+    Returns true if it was locked. If there is a system failure,
+    mutex_trylock prints a error message and exits the process. */
+static bool mutex_trylock(pthread_mutex_t *lock, char *name) {
+    int err = pthread_mutex_trylock(lock);
+    if (err == EBUSY)
+        return false;
+    if (err != 0) {
+        fprintf(stderr, "crew: %s: %s\n", name, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+/* crew_now: Returns the monotonic clock in milliseconds. */
+static long crew_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* crew_disconnect: Closes the worker's connection and backs off before
+    the next reconnect, doubling the wait on each failure. */
+static void crew_disconnect(crew_worker *worker) {
+    if (worker->fd != -1) {
+        close(worker->fd);
+        worker->fd = -1;
+    }
+    long backoff = 1000;
+    for (int i = 1; i < worker->failures && backoff < CREW_BACKOFF_MAX; i++)
+        backoff *= 2;
+    if (backoff > CREW_BACKOFF_MAX)
+        backoff = CREW_BACKOFF_MAX;
+    worker->failures++;
+    worker->retry_at = crew_now() + backoff;
+}
+
+/* crew_connect: Connects to the worker, unless it is backing off. Commands
+    on the connection time out after CREW_CALL_TIMEOUT ms. Returns 0 on
+    success, and -1 otherwise. */
+static int crew_connect(crew_worker *worker) {
+    if (worker->fd != -1)
+        return 0;
+    if (worker->failures > 0 && crew_now() < worker->retry_at)
+        return -1;
+    if ((worker->fd = net_connect_timeout(&worker->addr, CREW_CALL_TIMEOUT)) == -1) {
+        crew_disconnect(worker);
+        return -1;
+    }
+    return 0;
+}
+
+/* crew_call: Sends the request on the worker's connection and returns the
+    response body. Otherwise, returns NULL. A connection that sat idle may
+    have been closed by a restarted worker before it read anything, so a
+    request that fails that way on a reused connection is retried once on a
+    fresh one. A request that times out fails, and its connection is
+    closed, since a late response would be read as the answer to the next
+    command. Remark: The caller holds the connection lock. */
+static char *crew_call(crew_worker *worker, const char *req, size_t *len) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = worker->fd != -1;
+        if (crew_connect(worker) == -1)
+            return NULL;
+
+        char *buf = NULL;
+        if (frame_send(worker->fd, req, strlen(req)) == 0 &&
+            (buf = frame_recv(worker->fd, len)) != NULL) {
+            worker->failures = 0;
+            return buf;
+        }
+
+        if (reused && attempt == 0 && (errno == EPIPE || errno == ECONNRESET)) {
+            close(worker->fd);
+            worker->fd = -1;
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            fprintf(stderr, "crew: crew_call: Error: Worker %d timed out\n", worker->id);
+        else
+            perror("crew: crew_call");
+        crew_disconnect(worker);
+        return NULL;
+    }
+    return NULL;
+}
+
+/* send_request: Sends the serialized command to the worker over its
+    persistent connection and returns its response. Otherwise, returns NULL
+    and the worker is down until a reconnect succeeds. */
+static json_value *send_request(crew_worker *worker, const char *req) {
+    size_t len;
+    mutex_lock(&worker->conn, "send_request");
+    char *buf = crew_call(worker, req, &len);
+    mutex_unlock(&worker->conn, "send_request");
+    if (buf == NULL)
+        return NULL;
+
+    json_value *res;
+    if ((res = json_parse(buf, len)) == NULL) {
+        fprintf(stderr, "crew: send_request: Error: Unable to parse response\n");
+    }
+    free(buf);
+    return res;
+}
+
+/* crew_refused: Returns true if the worker's response is missing or is an
+    error, instead of the command's result. */
+static bool crew_refused(json_value *res) {
+    return res == NULL || res->type != json_object ||
+        json_get_value(res, "Error") != NULL || json_get_value(res, "error") != NULL;
+}
+
+/* send_command: Sends a command to the worker and returns its response. */
+static json_value* send_command(crew_worker *worker, json_value *cmd) {
+    char *req;
+    if ((req = malloc(json_measure(cmd))) == NULL) {
+        perror("crew: send_command: malloc");
+        return NULL;
+    }
+    json_serialize(req, cmd);
+    json_value *res = send_request(worker, req);
+    free(req);
+    return res;
+}
+
+/* crew_worker_create: Creates a new worker reachable at the address. */
+static crew_worker* crew_worker_create(int id, const net_addr* addr) {
     crew_worker* worker = malloc(sizeof(crew_worker));
     if (worker == NULL) {
         perror("crew_worker_create: malloc");
         return NULL;
     }
     worker->id = id;
-    worker->status = WORKER_NOT_ASSIGNED;
-    worker->job.id = -1;
-    worker->job.status = -1;
+    worker->index = -1;
+    worker->addr = *addr;
+    worker->fd = -1;
+    worker->failures = 0;
+    worker->retry_at = 0;
+    atomic_init(&worker->refs, 1);
+    worker->poll.fd = -1;
+    worker->poll.state = 0;
+    worker->poll.pending = 0;
+    worker->poll.next = 0;
+    worker->poll.last = 0;
+    worker->poll.sent = 0;
+    worker->poll.owed = -1;
+    worker->poll.mean = -1;
+    worker->poll.var = 0;
+    worker->poll.version = -1;
+    worker->poll.in = buffer_create(0);
+    worker->poll.out = buffer_create(0);
+    if (worker->poll.in == NULL || worker->poll.out == NULL) {
+        buffer_destroy(worker->poll.in);
+        buffer_destroy(worker->poll.out);
+        free(worker);
+        return NULL;
+    }
+    int err;
+    if ((err = pthread_mutex_init(&worker->conn, NULL)) != 0) {
+        fprintf(stderr, "crew: crew_worker_create: pthread_mutex_init: %s\n", strerror(err));
+        buffer_destroy(worker->poll.in);
+        buffer_destroy(worker->poll.out);
+        free(worker);
+        return NULL;
+    }
     return worker;
 }
 
 /* free_worker: Frees all resources allocated to the worker. */
-static void free_worker(Worker *worker) {
-    // Stop worker
-    json_value *cmd, *res;
-    char *stop = "{\"command\":\"stop\"}";
-    if (worker->status == worker_working) {
-        cmd = json_parse(stop, strlen(stop));
-        res = send_command(worker, cmd);
-        json_value_free(cmd);
-        json_value_free(res);
-    }
+static void free_worker(crew_worker *worker) {
+    if (worker->fd != -1)
+        close(worker->fd);
+    if (worker->poll.fd != -1)
+        close(worker->poll.fd);
+    buffer_destroy(worker->poll.in);
+    buffer_destroy(worker->poll.out);
+    pthread_mutex_destroy(&worker->conn);
     free(worker);
     return;
 }
 
-/* init_crew_list: Initializes the list. */
-static void init_crew_list(crew_list *l) {
-    l->head = NULL;
-    l->tail = NULL;
-    l->len = 0;
-    return;
+/* crew_worker_hold: Takes a reference to the worker, so that it outlives
+    its removal from the crew while the caller talks to it. Remark: The
+    caller holds the crew lock. */
+static crew_worker *crew_worker_hold(crew_worker *worker) {
+    atomic_fetch_add_explicit(&worker->refs, 1, memory_order_relaxed);
+    return worker;
 }
 
-/* free_crew_list: Frees the memory allocated to the list. */
-static void free_crew_list(crew_list *l) {
-    if (l->len == 0)
-        return;
-    
-    l->len = 0;
-    crew_node *curr = l->head;
-    while (curr->next) {
-        curr = curr->next;
-        free(curr->prev);
-        free_worker(curr->prev->worker);
-    }
-    free_worker(curr->worker);
-    free(curr);
-    l->head = NULL;
-    l->tail = NULL;
-    return;
+/* crew_worker_release: Drops a reference to the worker, and frees the
+    worker with the last one. */
+static void crew_worker_release(crew_worker *worker) {
+    if (atomic_fetch_sub_explicit(&worker->refs, 1, memory_order_acq_rel) == 1)
+        free_worker(worker);
 }
 
-/* in_crew_list: Checks if the id is in the crew_list and returns true, if the
-    the id equals one of the worker's id. Otherwise, returns false. */
-static bool in_crew_list(crew_list *l, int id) {
-    crew_node *curr = l->head;
-    while (curr) {
-        if (curr->worker->id == id)
-            return true;
-        curr = curr->next;
-    }
-    return false;
+/* crew_worker_stop: Stops the worker, if it is working. Remark: The caller
+    holds a reference to the worker, but not the crew lock. */
+static void crew_worker_stop(crew_worker *worker, int status) {
+    if (status == worker_working)
+        json_value_free(send_request(worker, CREW_STOP));
+}
+
+/* get_index: Gets the index of the worker by its id and returns it.
+    Otherwise, returns -1. */
+static int get_index(Crew *crew, int id) {
+    return idmap_get(crew->index, id);
 }
 
-/* get_crew_node: Gets the node from the list by its worker id and returns it.
+/* get_worker: Gets the worker by its id from the crew and returns it.
     Otherwise, returns NULL. */
-static crew_node *get_crew_node(crew_list *l, int id) {
-    if (l->len == 0)
+static crew_worker *get_worker(Crew *crew, int id) {
+    int i = idmap_get(crew->index, id);
+    if (i == -1)
         return NULL;
-    
-    crew_node *curr = l->head;
-    while (curr) {
-        if (curr->worker->id == id)
-            return curr;
-        curr = curr->next;
+    return crew->workers[i];
+}
+
+/* bit_set: Sets bit i of the bitset. */
+static void bit_set(uint64_t *set, int i) {
+    set[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+/* bit_clear: Clears bit i of the bitset. */
+static void bit_clear(uint64_t *set, int i) {
+    set[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+/* bit_test: Checks if bit i of the bitset is set. */
+static bool bit_test(const uint64_t *set, int i) {
+    return (set[i / 64] >> (i % 64)) & 1;
+}
+
+/* bit_move: Moves bit from of the bitset to bit to, which is clear. */
+static void bit_move(uint64_t *set, int from, int to) {
+    if (bit_test(set, from)) {
+        bit_set(set, to);
+        bit_clear(set, from);
     }
-    return NULL;
 }
 
-/* create_crew: Creates a new crew. */
-Crew *create_crew(void) {
-    Crew *crew;
-    if ((crew = malloc(sizeof(Crew))) == NULL) {
-        perror("crew: create_crew: malloc");
-        exit(EXIT_FAILURE);
+/* idle_word: Returns word w of the idle workers that are in all of the
+    classes, leaving out workers that are down. */
+static uint64_t idle_word(Crew *crew, int w, unsigned int classes) {
+    uint64_t bits = crew->idle[w] & ~crew->down[w];
+    for (unsigned int c = classes; c && bits; c &= c - 1)
+        bits &= crew->members[__builtin_ctz(c)][w];
+    return bits;
+}
+
+/* idle_find: Finds an idle worker that is in all of the classes and
+    returns its index. Otherwise, returns -1. The search starts after the
+    last worker found and wraps around, so work is spread over the crew.
+    Remark: Not thread safe. */
+static int idle_find(Crew *crew, unsigned int classes) {
+    int words = (crew->len + 63) / 64;
+    if (words == 0)
+        return -1;
+
+    int start = crew->idle_next / 64 % words;
+    for (int n = 0; n <= words; n++) {
+        int w = (start + n) % words;
+        uint64_t bits = idle_word(crew, w, classes);
+
+        // The start word is searched from the cursor, and once more from its
+        // first bit after wrapping around
+        if (n == 0)
+            bits &= ~(uint64_t)0 << (crew->idle_next % 64);
+        if (bits) {
+            int i = w * 64 + __builtin_ctzll(bits);
+            crew->idle_next = i + 1;
+            return i;
+        }
     }
-    for (int i = 0; i < _CREW_MAXLEN; ++i)
-        init_crew_list(&crew->workers[i]);
-    crew->len = 0;
-    crew->freelist.head = NULL;
-    crew->freelist.tail = NULL;
-    crew->freelist.len = 0;
-    int err;
-    if ((err = pthread_mutex_init(&crew->lock, NULL)) != 0) {
-        fprintf(stderr, "crew: create_crew: pthread_mutex_init: %s\n", strerror(err));
-        exit(EXIT_FAILURE);
+    return -1;
+}
+
+/* set_classes: Sets the class mask of the worker at index i. */
+static void set_classes(Crew *crew, int i, unsigned int classes) {
+    for (int c = 0; c < CREW_CLASSES; c++) {
+        if (classes & (1u << c))
+            bit_set(crew->members[c], i);
+        else
+            bit_clear(crew->members[c], i);
     }
-    return crew;
+    crew->classes[i] = classes;
+    return;
 }
 
-/* free_crew: Frees all the resources allocated to the crew. */
-void free_crew(Crew *crew) {
-    int err;
-    if ((err = pthread_mutex_lock(&crew->lock)) != 0) {
-        fprintf(stderr, "crew: free_crew: pthread_mutex_lock: %s\n", strerror(err));
-        exit(EXIT_FAILURE);
+/* crew_grow: Doubles the length of the crew's arrays. Returns 0 on success,
+    and -1 otherwise. */
+static int crew_grow(Crew *crew) {
+    int capacity = crew->capacity > 0 ? 2 * crew->capacity : CREW_MINCAP;
+    int **arrays[] = {
+        &crew->ids, &crew->status, &crew->job_ids, &crew->job_status, &crew->health
+    };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        int *p;
+        if ((p = realloc(*arrays[a], capacity * sizeof(int))) == NULL) {
+            perror("crew: crew_grow: realloc");
+            return -1;
+        }
+        *arrays[a] = p;
     }
-    
-    if (crew->len == 0)
-        goto unlock;
 
-    crew->len = 0;
-    for (int i = 0; i < _CREW_MAXLEN; i++)
-        free_crew_list(&crew->workers[i]);
+    long *job_start;
+    if ((job_start = realloc(crew->job_start, capacity * sizeof(long))) == NULL) {
+        perror("crew: crew_grow: realloc");
+        return -1;
+    }
+    crew->job_start = job_start;
 
-    unlock:
-    if ((err = pthread_mutex_unlock(&crew->lock)) != 0) {
-        fprintf(stderr, "crew: free_crew: pthread_mutex_unlock: %s\n", strerror(err));
-        exit(EXIT_FAILURE);
+    unsigned int *classes;
+    if ((classes = realloc(crew->classes, capacity * sizeof(unsigned int))) == NULL) {
+        perror("crew: crew_grow: realloc");
+        return -1;
     }
+    crew->classes = classes;
 
-    if ((err = pthread_mutex_destroy(&crew->lock)) != 0) {
-        fprintf(stderr, "crew: free_crew: pthread_mutex_destroy: %s\n", strerror(err));
-        exit(EXIT_FAILURE);
+    crew_worker **workers;
+    if ((workers = realloc(crew->workers, capacity * sizeof(crew_worker*))) == NULL) {
+        perror("crew: crew_grow: realloc");
+        return -1;
     }
-    free(crew);
+    crew->workers = workers;
+
+    // Bitsets start out empty
+    int words = crew->capacity / 64;
+    int new_words = capacity / 64;
+    uint64_t **sets[CREW_CLASSES + 2] = {&crew->idle, &crew->down};
+    for (int c = 0; c < CREW_CLASSES; c++)
+        sets[c + 2] = &crew->members[c];
+    for (int b = 0; b < CREW_CLASSES + 2; b++) {
+        uint64_t *p;
+        if ((p = realloc(*sets[b], new_words * sizeof(uint64_t))) == NULL) {
+            perror("crew: crew_grow: realloc");
+            return -1;
+        }
+        memset(p + words, 0, (new_words - words) * sizeof(uint64_t));
+        *sets[b] = p;
+    }
+    crew->capacity = capacity;
+    return 0;
+}
+
+/* crew_move: Moves the worker at index from to the unused index to. */
+static void crew_move(Crew *crew, int from, int to) {
+    crew->ids[to] = crew->ids[from];
+    crew->status[to] = crew->status[from];
+    crew->job_ids[to] = crew->job_ids[from];
+    crew->job_status[to] = crew->job_status[from];
+    crew->job_start[to] = crew->job_start[from];
+    crew->health[to] = crew->health[from];
+    crew->workers[to] = crew->workers[from];
+    crew->workers[to]->index = to;
+    idmap_put(crew->index, crew->ids[to], to);
+
+    set_classes(crew, to, crew->classes[from]);
+    set_classes(crew, from, 0);
+    bit_move(crew->idle, from, to);
+    bit_move(crew->down, from, to);
     return;
 }
 
-/* in_crew: Checks if the id is in the crew and returns true, if the id
-    equals one crew worker's id. Otherwise, returns false. */
-static bool in_crew(Crew *crew, int id) {
-    return in_crew_list(&crew->workers[id % _CREW_MAXLEN], id);
+// Poll connection states
+enum {
+    CREW_POLL_IDLE,         // closed, waiting to reconnect
+    CREW_POLL_CONNECTING,
+    CREW_POLL_WATCHING      // watch sent or queued, the worker pushes changes
+};
+
+// Poll requests. Watch is sent once on connect, and the snapshot is the
+// liveness probe.
+static const char* const CREW_POLL_WATCH = "{\"command\":\"watch\"}";
+static const char* const CREW_POLL_PROBE = "{\"command\":\"get_snapshot\"}";
+
+#define CREW_POLL_WAKE UINT64_MAX   // epoll data of the poller's event fd
+
+/* crew_poll_key: Returns the epoll data of the worker's poll connection. The
+    fd tells events of a closed connection apart from its replacement's. */
+static uint64_t crew_poll_key(crew_worker *worker) {
+    return (uint64_t)(unsigned int)worker->id << 32 | (unsigned int)worker->poll.fd;
 }
 
-/* get_worker: Gets the worker by its id from the crew and returns it.
-    Otherwise, returns NULL. */
-static Worker *get_worker(Crew *crew, int id) {
-    if (in_crew(crew, id) == false)
-        return NULL;
-    return get_crew_node(&crew->workers[id % _CREW_MAXLEN], id)->worker;
+/* crew_poll_close: Closes the worker's poll connection and schedules the
+    reconnect. */
+static void crew_poll_close(crew_worker *worker, long now) {
+    if (worker->poll.fd != -1) {
+        close(worker->poll.fd);
+        worker->poll.fd = -1;
+    }
+    buffer_clear(worker->poll.in);
+    buffer_clear(worker->poll.out);
+    worker->poll.state = CREW_POLL_IDLE;
+    worker->poll.pending = 0;
+    worker->poll.next = now + CREW_POLL_RETRY;
+
+    // A lost connection leaves the worker owing an answer
+    if (worker->poll.owed == -1)
+        worker->poll.owed = now;
+}
+
+/* crew_poll_send: Forward declaration for crew_poll_revive. */
+static int crew_poll_send(Crew *crew, crew_worker *worker, const char *req, long now);
+
+/* crew_poll_version: Returns the state version of a snapshot message, read
+    from its first bytes without parsing it. Otherwise, returns -1. */
+static long crew_poll_version(const char *buf, size_t len) {
+    const char *key = "\"version\":";
+    size_t keylen = strlen(key);
+    size_t n = len < 48 ? len : 48;
+    const char *p = NULL;
+    for (size_t i = 0; i + keylen <= n && p == NULL; i++)
+        if (memcmp(buf + i, key, keylen) == 0)
+            p = buf + i;
+    if (p == NULL)
+        return -1;
+
+    const char *end = buf + len;
+    p += keylen;
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end || *p < '0' || *p > '9')
+        return -1;
+    long version = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        version = version * 10 + (*p++ - '0');
+    return version;
 }
 
-/* freelist_push: Adds the node to the head of the crew freelist. */
-static void freelist_push(Crew *crew, int id) {
-    if (in_crew(crew, id) == false) {
-        fprintf(stderr, "crew: freelist_push: warning: trying to push invalid worker id to the freelist\n");
+/* crew_orphan: Forward declaration for crew_poll_apply. */
+static void crew_orphan(Crew *crew, int job_id);
+
+/* crew_poll_apply: Updates the worker from its status and its job status
+    values, the latter of which may be missing. A job seen ending adds its
+    time to the crew's mean job time, and a worker seen losing its job is
+    idle again. */
+static void crew_poll_apply(Crew *crew, crew_worker *worker, json_value *status, json_value *job_status, long now) {
+    int code;
+    if (status->type != json_string) {
+        fprintf(stderr, "crew: crew_poll_apply: Error: Invalid JSON value\n");
         return;
     }
-
-    crew_node *node = get_crew_node(&crew->workers[id % _CREW_MAXLEN], id);
-    node->prev_free = NULL;
-    if (crew->freelist.len++ == 0) {
-        node->next_free = NULL;
-        crew->freelist.head = node;
-        crew->freelist.tail = node;
+    if ((code = worker_status_map(status->u.string.ptr)) == -1) {
+        fprintf(stderr, "crew: crew_poll_apply: worker_status_map: Error: Unknown worker status\n");
         return;
     }
-    node->next_free = crew->freelist.head;
-    crew->freelist.head->prev_free = node;
-    crew->freelist.head = node;
-    return;
+    int i = worker->index;
+    int prev = crew->status[i];
+    crew->status[i] = code;
+
+    // An unassigned worker has no job. One that was assigned lost its job,
+    // like a restarted worker, so a running job is handed back to the
+    // manager and the worker is idle again. Right after an assign, the
+    // message may be from before the job arrived, and the next one decides.
+    if (code == worker_not_assigned) {
+        if (prev == worker_not_assigned)
+            return;
+        if (crew->job_start[i] > 0 && now - crew->job_start[i] < CREW_ASSIGN_GRACE) {
+            crew->status[i] = prev;
+            return;
+        }
+        if (crew->job_status[i] == job_running && crew->job_ids[i] != -1)
+            crew_orphan(crew, crew->job_ids[i]);
+        bit_set(crew->idle, i);
+        crew->job_ids[i] = -1;
+        crew->job_status[i] = -1;
+        crew->job_start[i] = 0;
+        return;
+    }
+    int job = -1;
+    if (job_status && job_status->type == json_string)
+        job = job_status_map(job_status->u.string.ptr);
+    if (job != -1 && job != job_running && crew->job_start[i] > 0) {
+        double took = now - crew->job_start[i];
+        crew->job_mean = crew->job_mean > 0 ? crew->job_mean + (took - crew->job_mean) / 8 : took;
+        crew->job_start[i] = 0;
+    }
+    crew->job_status[i] = job;
 }
 
-/* freelist_pop: Pops the first worker from the crew freelist and returns its id.
-    Otherwise, returns -1. Remark: Not thread safe. */
-static int freelist_pop(Crew *crew) {
-    if (crew->freelist.len == 0)
-        return -1;
+/* crew_poll_revive: Brings back a dead worker that answered. Its job was
+    handed back to the manager, so a worker still on a job is stopped.
+    Returns 0 if the worker is unassigned, and -1 if it was stopped. */
+static int crew_poll_revive(Crew *crew, crew_worker *worker, json_value *status, long now) {
+    int i = worker->index;
+    fprintf(stderr, "crew: crew_poll_revive: Worker %d is alive\n", worker->id);
+    crew->health[i] = CREW_ALIVE;
+    bit_clear(crew->down, i);
+    if (status->type == json_string &&
+        worker_status_map(status->u.string.ptr) == worker_not_assigned)
+        return 0;
+    if (crew_poll_send(crew, worker, CREW_STOP, now) == -1)
+        fprintf(stderr, "crew: crew_poll_revive: Error: Unable to stop worker %d\n", worker->id);
+    return -1;
+}
 
-    crew_node *node = crew->freelist.head;
-    if (crew->freelist.len-- == 1) {
-        crew->freelist.head = NULL;
-        crew->freelist.tail = NULL;
-        node->next_free = NULL;
-        return node->worker->id;
+/* crew_poll_update: Updates the worker from a message on its poll
+    connection: a snapshot, or the statuses of a watch response or push. A
+    snapshot of the version last applied is skipped without parsing, and
+    answers without a status, like stop's, are ignored. */
+static void crew_poll_update(Crew *crew, crew_worker *worker, const char *buf, size_t len, long now) {
+    long version = crew_poll_version(buf, len);
+    if (version != -1 && version == worker->poll.version)
+        return;
+
+    json_value *res;
+    if ((res = json_parse(buf, len)) == NULL) {
+        fprintf(stderr, "crew: crew_poll_update: json_parse: Unable to parse response\n");
+        return;
     }
-    crew->freelist.head = node->next_free;
-    crew->freelist.head->prev_free = NULL;
-    node->next_free = NULL;
-    return node->worker->id;
-}
 
-/* freelist_append: Adds the worker to the tail of the crew freelist. */
-static void freelist_append(Crew *crew, int id) {
-    if (in_crew(crew, id) == false) {
-        fprintf(stderr, "crew: freelist_append: warning: trying to add invalid worker id to the freelist\n");
+    json_value *snapshot = json_get_value(res, "snapshot");
+    json_value *status = json_get_value(snapshot ? snapshot : res, "status");
+    if (status == NULL ||
+        (crew->health[worker->index] == CREW_DEAD && crew_poll_revive(crew, worker, status, now) == -1)) {
+        json_value_free(res);
         return;
     }
+    if (snapshot == NULL) {
+        crew_poll_apply(crew, worker, status, json_get_value(res, "blueprint_status"), now);
+        json_value_free(res);
+        return;
+    }
+
+    json_value *job = json_get_value(snapshot, "job");
+    json_value *job_status = NULL;
+    if (job && job->type == json_object) {
+        json_value *id = json_get_value(job, "id");
+        if (id && id->type == json_integer)
+            crew->job_ids[worker->index] = id->u.integer;
+        job_status = json_get_value(job, "status");
+    }
+    crew_poll_apply(crew, worker, status, job_status, now);
+    worker->poll.version = version;
+    json_value_free(res);
+}
 
-    crew_node *node = get_crew_node(&crew->workers[id % _CREW_MAXLEN], id);
-    node->next_free = NULL;
-    if (crew->freelist.len++ == 0) {
-        node->prev_free = NULL;
-        crew->freelist.head = node;
-        crew->freelist.tail = node;
+/* crew_poll_sample: Adds the delay of an answer to the worker's moving
+    mean and variance, which follow its recent delays. */
+static void crew_poll_sample(crew_worker *worker, long delay) {
+    if (worker->poll.mean < 0) {
+        worker->poll.mean = delay;
+        worker->poll.var = (delay / 4.0) * (delay / 4.0);
         return;
     }
-    node->prev_free = crew->freelist.tail;
-    crew->freelist.tail->next_free = node;
-    crew->freelist.tail = node;
-    return;
+    double diff = delay - worker->poll.mean;
+    worker->poll.mean += diff / 8;
+    worker->poll.var = (worker->poll.var + diff * diff / 8) * 7 / 8;
 }
 
-/* worker_socket_handler: Closes the socket. */
-static void *worker_socket_handler(void *arg) {
-    if (close(*(int *)arg) == -1) {
-        perror("crew: worker_socket_handler: close");
-        exit(EXIT_FAILURE);
+/* crew_poll_heard: Records a message from the worker. The delay of the
+    answer to a probe is sampled, and a suspect worker is alive again. */
+static void crew_poll_heard(Crew *crew, crew_worker *worker, long now) {
+    if (worker->poll.pending > 0)
+        crew_poll_sample(worker, now - worker->poll.sent);
+    worker->poll.pending = 0;
+    worker->poll.owed = -1;
+    worker->poll.last = now;
+
+    int i = worker->index;
+    if (crew->health[i] == CREW_SUSPECT) {
+        crew->health[i] = CREW_ALIVE;
+        bit_clear(crew->down, i);
     }
-    return NULL;
 }
 
-/* worker_thread: Updates the status of the worker and its job. */
-static void *worker_thread(void *args) {
-    Worker *worker = args;
+/* crew_phi: Returns how strongly the worker is suspected to have failed,
+    from how long it has owed an answer. Phi is -log10 of the chance that an
+    answer comes this late, with the worker's answer delays taken as normally
+    distributed, so at a phi of 3 the worker is wrongly suspected about one
+    time in a thousand. */
+static double crew_phi(crew_worker *worker, long now) {
+    if (worker->poll.owed == -1)
+        return 0;
+    double mean = (worker->poll.mean > 0 ? worker->poll.mean : 0) + CREW_PHI_PAUSE;
+    double stddev = sqrt(worker->poll.var);
+    if (stddev < CREW_PHI_MIN_STDDEV)
+        stddev = CREW_PHI_MIN_STDDEV;
+
+    // Logistic approximation of the normal distribution's tail
+    double y = (now - worker->poll.owed - mean) / stddev;
+    double e = exp(-y * (1.5976 + 0.070566 * y * y));
+    if (y > 0)
+        return -log10(e / (1.0 + e));
+    return -log10(1.0 - 1.0 / (1.0 + e));
+}
 
-    // Create unix socket
-    int sockfd;
-    if ((sockfd = socket(AF_LOCAL, SOCK_STREAM, 0)) == -1) {
-        perror("crew: worker_thread: socket");
-        exit(EXIT_FAILURE);
+/* crew_orphan: Hands the job back to the manager. */
+static void crew_orphan(Crew *crew, int job_id) {
+    if (crew->orphans_len == crew->orphans_cap) {
+        int cap = crew->orphans_cap > 0 ? 2 * crew->orphans_cap : 16;
+        int *orphans;
+        if ((orphans = realloc(crew->orphans, cap * sizeof(int))) == NULL) {
+            perror("crew: crew_orphan: realloc");
+            return;
+        }
+        crew->orphans = orphans;
+        crew->orphans_cap = cap;
     }
-    struct sockaddr_un servaddr;
-    bzero(&servaddr, sizeof(servaddr));
-    servaddr.sun_family = AF_LOCAL;
-#ifdef __APPLE__
-    snprintf(servaddr.sun_path, sizeof(servaddr.sun_path),
-        "/Users/leejahsprock/pyoneer/run/worker%d.socket", worker->id);
-#elif __linux__
-    snprintf(servaddr.sun_path, sizeof(servaddr.sun_path),
-        "/home/jsoychak/pyoneer/run/worker%d.socket", worker->id);
-#endif
-
-    if (connect(sockfd, &servaddr, sizeof(servaddr)) == -1) {
-        perror("crew: worker_thread: connect");
-        exit(EXIT_FAILURE);
+    crew->orphans[crew->orphans_len++] = job_id;
+}
+
+/* crew_poll_health: Marks the worker suspect or dead by its phi. A dead
+    worker's connection is closed, and a job it was running is handed back
+    to the manager, leaving the worker unassigned. */
+static void crew_poll_health(Crew *crew, crew_worker *worker, long now) {
+    int i = worker->index;
+    if (crew->health[i] == CREW_DEAD)
+        return;
+    double phi = crew_phi(worker, now);
+    if (phi < CREW_PHI_SUSPECT)
+        return;
+    bit_set(crew->down, i);
+    if (phi < CREW_PHI_DEAD) {
+        crew->health[i] = CREW_SUSPECT;
+        return;
     }
 
-    // Update worker status and job status
-    int nbyte, status;
-    char buf[BUFLEN];
-    char *get_status = "{\"command\":\"get_status\"}";
-    char *get_job_status = "{\"command\":\"get_job_status\"}";
-    json_value *res, *val;
-    pthread_cleanup_push(worker_socket_handler, &sockfd);
-    while (sleep(1) == 0) {
-        // Get worker status
-        if (send(sockfd, get_status, strlen(get_status), 0) == -1) {
-            perror("crew: worker_thread: send");
-            exit(EXIT_FAILURE);
-        }
+    fprintf(stderr, "crew: crew_poll_health: Worker %d is dead\n", worker->id);
+    crew->health[i] = CREW_DEAD;
+    crew_poll_close(worker, now);
+    worker->poll.version = -1;
+    if (crew->status[i] == worker_not_assigned || crew->job_status[i] != job_running)
+        return;
+    crew_orphan(crew, crew->job_ids[i]);
+    bit_set(crew->idle, i);
+    crew->status[i] = worker_not_assigned;
+    crew->job_ids[i] = -1;
+    crew->job_status[i] = -1;
+    crew->job_start[i] = 0;
+}
 
-        if ((nbyte = recv(sockfd, &buf, BUFLEN, 0)) == -1) {
-            perror("crew: worker_thread: recv");
-            exit(EXIT_FAILURE);
+/* crew_poll_flush: Sends as much of the worker's queued requests as the
+    socket takes, and only waits for writability while some are left.
+    Returns 0 on success, and -1 if the connection failed. */
+static int crew_poll_flush(Crew *crew, crew_worker *worker) {
+    Buffer *out = worker->poll.out;
+    while (out->len > 0) {
+        ssize_t nbytes = send(worker->poll.fd, out->data, out->len, MSG_NOSIGNAL);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
         }
-        buf[nbyte > BUFLEN ? BUFLEN - 1 : nbyte] = '\0';
+        buffer_consume(out, nbytes);
+    }
 
-        if ((res = json_parse(buf, strlen(buf))) == NULL) {
-            fprintf(stderr, "crew: worker_thread: json_parse: Unable to parse response\n");
-            continue;
-        }
-        
-        if ((val = json_get_value(res, "status")) == NULL) {
-            fprintf(stderr, "crew: worker_thread: json_get_value: Error: Missing JSON value\n");
-            json_value_free(res);
-            continue;
-        }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | (out->len > 0 ? EPOLLOUT : 0);
+    ev.data.u64 = crew_poll_key(worker);
+    return epoll_ctl(crew->epoll_fd, EPOLL_CTL_MOD, worker->poll.fd, &ev);
+}
 
-        // Update worker status
-        if ((status = worker_status_map(val->u.string.ptr)) == -1) {
-            fprintf(stderr, "crew: worker_thread: worker_status_map: Error: Unknown worker status\n");
-            json_value_free(res);
-            continue;
+/* crew_poll_read: Reads the worker's messages and applies each complete
+    one. Any message shows the worker is alive, so it answers an
+    outstanding probe and postpones the next. Returns 0 on success, and -1
+    if the connection failed. */
+static int crew_poll_read(Crew *crew, crew_worker *worker, long now) {
+    Buffer *in = worker->poll.in;
+    for (;;) {
+        if (buffer_reserve(in, 4096) == -1)
+            return -1;
+        ssize_t nbytes = recv(worker->poll.fd, in->data + in->len, in->capacity - in->len - 1, 0);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
         }
-        worker->status = status;
-        json_value_free(res);
+        if (nbytes == 0)
+            return -1;
+        in->len += nbytes;
+    }
 
-        if (worker->status == worker_not_assigned)
-            continue;
+    frame f;
+    int ret;
+    while ((ret = frame_next(in->data, in->len, &f)) == 1) {
+        crew_poll_heard(crew, worker, now);
+        crew_poll_update(crew, worker, f.body, f.len, now);
+        buffer_consume(in, f.size);
+    }
+    return ret == -1 ? -1 : 0;
+}
 
-        // Get worker job status
-        if (send(sockfd, get_job_status, strlen(get_job_status), 0) == -1) {
-            perror("crew: worker_thread: send");
-            exit(EXIT_FAILURE);
-        }
+/* crew_poll_send: Queues the request on the worker's poll connection and
+    sends it once the connection is up. Returns 0 on success, and -1
+    otherwise. */
+static int crew_poll_send(Crew *crew, crew_worker *worker, const char *req, long now) {
+    if (frame_push(worker->poll.out, req, strlen(req)) == -1)
+        return -1;
+    if (worker->poll.pending == 0)
+        worker->poll.sent = now;
+    if (worker->poll.owed == -1)
+        worker->poll.owed = now;
+    worker->poll.pending = 1;
+    worker->poll.last = now;
+    if (worker->poll.state == CREW_POLL_WATCHING)
+        return crew_poll_flush(crew, worker);
+    return 0;
+}
 
-        if ((nbyte = recv(sockfd, &buf, BUFLEN, 0)) == -1) {
-            perror("crew: worker_thread: recv");
-            exit(EXIT_FAILURE);
-        }
-        buf[nbyte > BUFLEN ? BUFLEN - 1 : nbyte] = '\0';
+/* crew_poll_open: Connects the worker's poll connection and watches the
+    worker over it. */
+static void crew_poll_open(Crew *crew, crew_worker *worker, long now) {
+    if ((worker->poll.fd = net_connect_nonblock(&worker->addr)) == -1) {
+        crew_poll_close(worker, now);
+        return;
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u64 = crew_poll_key(worker);
+    if (epoll_ctl(crew->epoll_fd, EPOLL_CTL_ADD, worker->poll.fd, &ev) == -1) {
+        perror("crew: crew_poll_open: epoll_ctl");
+        crew_poll_close(worker, now);
+        return;
+    }
+    worker->poll.state = CREW_POLL_CONNECTING;
+    worker->poll.next = now + CREW_POLL_INTERVAL;
+    if (crew_poll_send(crew, worker, CREW_POLL_WATCH, now) == -1)
+        crew_poll_close(worker, now);
+}
 
-        if ((res = json_parse(buf, strlen(buf))) == NULL) {
-            fprintf(stderr, "crew: worker_thread: json_parse: Unable to parse response\n");
-            continue;
+/* crew_poll_event: Drives the worker's poll connection on an epoll event. */
+static void crew_poll_event(Crew *crew, crew_worker *worker, uint32_t events, long now) {
+    if (worker->poll.state == CREW_POLL_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(worker->poll.fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+            crew_poll_close(worker, now);
+            return;
         }
+        worker->poll.state = CREW_POLL_WATCHING;
+    }
 
-        if ((val = json_get_value(res, "job_status")) == NULL) {
-            fprintf(stderr, "crew: worker_thread: json_get_value: Error: Missing JSON value\n");
-            json_value_free(res);
-            continue;
-        }
+    if ((events & EPOLLOUT) && crew_poll_flush(crew, worker) == -1) {
+        crew_poll_close(worker, now);
+        return;
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && crew_poll_read(crew, worker, now) == -1)
+        crew_poll_close(worker, now);
+}
+
+/* crew_poll_interval: Returns the time between probes of the worker.
+    Unassigned workers are probed least often, and working workers most
+    often once their job has run nearly as long as the crew's jobs take. */
+static long crew_poll_interval(Crew *crew, crew_worker *worker, long now) {
+    int i = worker->index;
+    if (crew->status[i] == worker_not_assigned)
+        return CREW_POLL_IDLE_INTERVAL;
+    if (crew->job_mean > 0 && crew->job_start[i] > 0 &&
+        now - crew->job_start[i] >= crew->job_mean * CREW_POLL_NEAR / 100)
+        return CREW_POLL_NEAR_INTERVAL;
+    return CREW_POLL_INTERVAL;
+}
 
-        switch (val->type) {
-            case json_string:
-                status = job_status_map(val->u.string.ptr);
+/* crew_poll_due: Checks the health of each worker, connects each closed
+    worker whose reconnect is due, and probes each watched worker that has
+    been silent for its poll interval. */
+static void crew_poll_due(Crew *crew, long now) {
+    for (int i = 0; i < crew->len; i++) {
+        crew_worker *worker = crew->workers[i];
+        crew_poll_health(crew, worker, now);
+        switch (worker->poll.state) {
+            case CREW_POLL_IDLE:
+                if (now >= worker->poll.next)
+                    crew_poll_open(crew, worker, now);
                 break;
-            case json_null:
-                status = -1;
+            case CREW_POLL_CONNECTING:
+                if (now >= worker->poll.next)
+                    crew_poll_close(worker, now);
                 break;
-            default:
-                status = -1;
+            case CREW_POLL_WATCHING:
+                if (worker->poll.pending == 0 &&
+                    now >= worker->poll.last + crew_poll_interval(crew, worker, now) &&
+                    crew_poll_send(crew, worker, CREW_POLL_PROBE, now) == -1)
+                    crew_poll_close(worker, now);
                 break;
         }
-        worker->job.status = status;
-        json_value_free(res);
     }
+}
+
+/* crew_poller: Watches the status of every worker in the crew from a
+    single thread. Each worker's poll connection is a non-blocking state
+    machine multiplexed with epoll, so the crew costs one thread at any
+    size. */
+static void *crew_poller(void *arg) {
+    Crew *crew = arg;
+    struct epoll_event events[CREW_POLL_EVENTS];
+    long tick = 0;
+    while (atomic_load(&crew->running)) {
+        int n = epoll_wait(crew->epoll_fd, events, CREW_POLL_EVENTS, CREW_POLL_TICK);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("crew: crew_poller: epoll_wait");
+            break;
+        }
+
+        mutex_lock(&crew->lock, "crew_poller");
+        long now = crew_now();
+        for (int i = 0; i < n; i++) {
+            uint64_t key = events[i].data.u64;
+            if (key == CREW_POLL_WAKE) {
+                uint64_t count;
+                if (read(crew->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+                    perror("crew: crew_poller: read");
+                continue;
+            }
+
+            // Skip events of connections closed since epoll_wait returned
+            crew_worker *worker = get_worker(crew, (int)(key >> 32));
+            if (worker == NULL || worker->poll.fd == -1 || crew_poll_key(worker) != key)
+                continue;
+            crew_poll_event(crew, worker, events[i].events, now);
+        }
 
-    pthread_cleanup_pop(0);
+        if (now >= tick) {
+            tick = now + CREW_POLL_TICK;
+            crew_poll_due(crew, now);
+        }
+        mutex_unlock(&crew->lock, "crew_poller");
+    }
     return NULL;
 }
 
-/* add_worker: Creates a workers and adds it to the crew. */
-int add_worker(Crew *crew, int id) {
-    mutex_lock(&crew->lock, "add_worker");
-
-    crew_list *list = &crew->workers[id % _CREW_MAXLEN];
-    if (in_crew_list(list, id) == true) {
-        mutex_unlock(&crew->lock, "add_worker");
-        return -1;
+/* create_crew: Creates a new crew. */
+Crew *create_crew(void) {
+    Crew *crew;
+    if ((crew = malloc(sizeof(Crew))) == NULL) {
+        perror("crew: create_crew: malloc");
+        exit(EXIT_FAILURE);
+    }
+    crew->len = 0;
+    crew->capacity = 0;
+    crew->ids = NULL;
+    crew->status = NULL;
+    crew->job_ids = NULL;
+    crew->job_status = NULL;
+    crew->job_start = NULL;
+    crew->health = NULL;
+    crew->classes = NULL;
+    crew->workers = NULL;
+    crew->idle = NULL;
+    crew->down = NULL;
+    for (int c = 0; c < CREW_CLASSES; c++)
+        crew->members[c] = NULL;
+    crew->idle_next = 0;
+    crew->job_mean = 0;
+    crew->orphans = NULL;
+    crew->orphans_len = 0;
+    crew->orphans_cap = 0;
+    if ((crew->index = idmap_create(2 * CREW_MINCAP)) == NULL || crew_grow(crew) == -1)
+        exit(EXIT_FAILURE);
+    int err;
+    if ((err = pthread_mutex_init(&crew->lock, NULL)) != 0) {
+        fprintf(stderr, "crew: create_crew: pthread_mutex_init: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
     }
 
-    crew_node *node;
-    if ((node = malloc(sizeof(crew_node))) == NULL) {
-        perror("crew: add_crew_worker: malloc");
+    // Start the poller
+    if ((crew->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("crew: create_crew: epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    if ((crew->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("crew: create_crew: eventfd");
         exit(EXIT_FAILURE);
     }
-    node->worker = crew_worker_create(id);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u64 = CREW_POLL_WAKE;
+    if (epoll_ctl(crew->epoll_fd, EPOLL_CTL_ADD, crew->event_fd, &ev) == -1) {
+        perror("crew: create_crew: epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&crew->running, 1);
+    if ((err = pthread_create(&crew->tid, NULL, crew_poller, crew)) != 0) {
+        fprintf(stderr, "crew: create_crew: pthread_create: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    return crew;
+}
+
+/* free_crew: Frees all the resources allocated to the crew. Working
+    workers are stopped, after the crew lock is released. */
+void free_crew(Crew *crew) {
+    // Stop the poller
+    uint64_t one = 1;
+    atomic_store(&crew->running, 0);
+    if (write(crew->event_fd, &one, sizeof(one)) == -1)
+        perror("crew: free_crew: write");
+    pthread_join(crew->tid, NULL);
+    close(crew->event_fd);
+    close(crew->epoll_fd);
+
+    // Detach the workers
+    mutex_lock(&crew->lock, "free_crew");
+    int n = crew->len;
+    crew->len = 0;
+    mutex_unlock(&crew->lock, "free_crew");
+
+    for (int i = 0; i < n; i++) {
+        crew_worker_stop(crew->workers[i], crew->status[i]);
+        crew_worker_release(crew->workers[i]);
+    }
+
+    idmap_destroy(crew->index);
+    free(crew->ids);
+    free(crew->status);
+    free(crew->job_ids);
+    free(crew->job_status);
+    free(crew->job_start);
+    free(crew->health);
+    free(crew->classes);
+    free(crew->workers);
+    free(crew->idle);
+    free(crew->down);
+    for (int c = 0; c < CREW_CLASSES; c++)
+        free(crew->members[c]);
+    free(crew->orphans);
 
-    // create worker thread
     int err;
-    if ((err = pthread_create(&node->tid, NULL, worker_thread, node->worker)) != 0) {
-        fprintf(stderr, "crew: add_worker: pthread_create: %s\n", strerror(err));
+    if ((err = pthread_mutex_destroy(&crew->lock)) != 0) {
+        fprintf(stderr, "crew: free_crew: pthread_mutex_destroy: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    free(crew);
+    return;
+}
+
+/* crew_add_addr: Creates a worker reachable at the address and adds it to
+    the crew. */
+static int crew_add_addr(Crew *crew, int id, const net_addr *addr) {
+    mutex_lock(&crew->lock, "add_worker");
+
+    if (get_index(crew, id) != -1) {
         mutex_unlock(&crew->lock, "add_worker");
         return -1;
     }
-
-    crew->len++;
-    node->next = NULL;
-    node->next_free = NULL;
-
-    // add the node to the end of the list
-    if (list->len++ == 0) {
-        node->prev = NULL;
-        list->head = node;
-        list->tail = node;
-    } else {
-        node->prev = list->tail;
-        list->tail->next = node;
-        list->tail = node;
+    if (crew->len == crew->capacity && crew_grow(crew) == -1) {
+        mutex_unlock(&crew->lock, "add_worker");
+        return -1;
     }
 
-    // add the node to the end of the freelist
-    if (crew->freelist.len++ == 0) {
-        node->prev_free = NULL;
-        crew->freelist.head = node;
-        crew->freelist.tail = node;
-    } else {
-        node->prev_free = crew->freelist.tail;
-        crew->freelist.tail->next_free = node;
-        crew->freelist.tail = node;
+    crew_worker *worker;
+    if ((worker = crew_worker_create(id, addr)) == NULL) {
+        mutex_unlock(&crew->lock, "add_worker");
+        return -1;
+    }
+    int i = crew->len;
+    if (idmap_put(crew->index, id, i) == -1) {
+        free_worker(worker);
+        mutex_unlock(&crew->lock, "add_worker");
+        return -1;
     }
 
+    // add the worker to the end of the arrays, idle and without classes
+    crew->len++;
+    worker->index = i;
+    crew->ids[i] = id;
+    crew->status[i] = worker_not_assigned;
+    crew->job_ids[i] = -1;
+    crew->job_status[i] = -1;
+    crew->job_start[i] = 0;
+    crew->health[i] = CREW_ALIVE;
+    crew->workers[i] = worker;
+    set_classes(crew, i, 0);
+    bit_set(crew->idle, i);
+
     mutex_unlock(&crew->lock, "add_worker");
     return 0;
 }
 
-/* remove_worker: Removes a worker from the crew with its id. */
+/* add_worker: Creates a worker listening on its local socket,
+    PYONEER_DIR/worker<id>.sock, and adds it to the crew. */
+int add_worker(Crew *crew, int id) {
+    char* dir = getenv("PYONEER_DIR");
+    if (dir == NULL) {
+        fprintf(stderr, "crew: add_worker: Error: Missing PYONEER_DIR environment variable\n");
+        return -1;
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/worker%d.sock", dir, id);
+
+    net_addr addr;
+    if (net_addr_unix(&addr, path) == -1)
+        return -1;
+    return crew_add_addr(crew, id, &addr);
+}
+
+/* crew_add_remote: Creates a worker listening on TCP at "host:port" and
+    adds it to the crew. The address is resolved once, here. */
+int crew_add_remote(Crew *crew, int id, const char *hostport) {
+    net_addr addr;
+    if (net_addr_tcp(&addr, hostport) == -1)
+        return -1;
+    return crew_add_addr(crew, id, &addr);
+}
+
+/* remove_worker: Removes a worker from the crew with its id, and stops it
+    once the crew lock is released. */
 int remove_worker(Crew *crew, int id) {
     mutex_lock(&crew->lock, "remove_worker");
-    if (in_crew(crew, id) == false) {
+    int i = get_index(crew, id);
+    if (i == -1) {
         mutex_unlock(&crew->lock, "remove_worker");
         return -1;
     }
-    crew->len--;
-    crew_list *list = &crew->workers[id % _CREW_MAXLEN];
-    crew_node *node = get_crew_node(list, id);
+    crew_worker *worker = crew->workers[i];
+    int status = crew->status[i];
+    crew_poll_close(worker, 0);
+
+    // remove the worker, and fill its index with the last one
+    bit_clear(crew->idle, i);
+    bit_clear(crew->down, i);
+    set_classes(crew, i, 0);
+    idmap_remove(crew->index, id);
+    if (i != --crew->len)
+        crew_move(crew, crew->len, i);
+    mutex_unlock(&crew->lock, "remove_worker");
 
     // stop worker
-    json_value *cmd = json_parse(STOP, strlen(STOP));
-    json_value_free(send_command(node->worker, cmd));
-    json_value_free(cmd);
-
-    // remove node from freelist
-    if (node->prev_free == NULL)
-        crew->freelist.head = node->next_free;
-    else
-        node->prev_free->next_free = node->next_free;
-    if (node->next_free == NULL)
-        crew->freelist.tail = node->prev_free;
-    else
-        node->next_free->prev_free = node->prev_free;
-    crew->freelist.len--;
-
-    // remove node from workers
-    if (node->prev == NULL)
-        list->head = node->next;
-    else
-        node->prev->next = node->next;
-    if (node->next == NULL)
-        list->tail = node->prev;
-    else
-        node->next->prev = node->prev;
-    list->len--;
-
-    mutex_unlock(&crew->lock, "remove_worker");
+    crew_worker_stop(worker, status);
+    crew_worker_release(worker);
     return 0;
 }
 
@@ -532,13 +1088,13 @@ int remove_worker(Crew *crew, int id) {
 worker_status get_worker_status(Crew *crew, int id) {
     mutex_lock(&crew->lock, "get_worker_status");
 
-    crew_list *list = &crew->workers[id % _CREW_MAXLEN];
-    if (in_crew_list(list, id) == false) {
+    int i = get_index(crew, id);
+    if (i == -1) {
         mutex_unlock(&crew->lock, "get_worker_status");
         return -1;
     }
-    
-    worker_status status = get_crew_node(list, id)->worker->status;
+
+    worker_status status = crew->status[i];
     mutex_unlock(&crew->lock, "get_worker_status");
     return status;
 }
@@ -548,95 +1104,432 @@ worker_status get_worker_status(Crew *crew, int id) {
 job_status get_worker_job_status(Crew *crew, int id) {
     mutex_lock(&crew->lock, "get_worker_job_status");
 
-    crew_list *list = &crew->workers[id % _CREW_MAXLEN];
-    if (in_crew_list(list, id) == false) {
+    int i = get_index(crew, id);
+    if (i == -1) {
         mutex_unlock(&crew->lock, "get_worker_job_status");
         return -1;
     }
 
-    job_status status = get_crew_node(list, id)->worker->job.status;
+    job_status status = crew->job_status[i];
     mutex_unlock(&crew->lock, "get_worker_job_status");
     return status;
 }
 
-/* assign_job: Assigns a job to a worker in the crew and returns its id. 
-    Otherwise, returns -1. */
-int assign_job(Crew *crew, json_value *job) {
-    mutex_lock(&crew->lock, "assign_job");
-
-    int id = freelist_pop(crew);
-    if (id == -1) {
-        mutex_unlock(&crew->lock, "assign_job");
+/* crew_assign_class: Assigns a job to an idle worker in all of the classes
+    and returns its id. Otherwise, returns -1. The job is sent after the
+    crew lock is released, and the worker is idle again if it can't be
+    reached or answers with an error. */
+int crew_assign_class(Crew *crew, json_value *job, unsigned int classes) {
+    // build command
+    const char *fmt = "{\"command\":\"run_job\",\"job\":%s}";
+    char *body, *req;
+    if ((body = malloc(json_measure(job))) == NULL) {
+        perror("crew: crew_assign_class: malloc");
+        return -1;
+    }
+    json_serialize(body, job);
+    size_t len = strlen(fmt) + strlen(body);
+    if ((req = malloc(len)) == NULL) {
+        perror("crew: crew_assign_class: malloc");
+        free(body);
+        return -1;
+    }
+    snprintf(req, len, fmt, body);
+    free(body);
+
+    mutex_lock(&crew->lock, "crew_assign_class");
+    int i = idle_find(crew, classes);
+    if (i == -1) {
+        mutex_unlock(&crew->lock, "crew_assign_class");
+        free(req);
         return -1;
     }
+    bit_clear(crew->idle, i);
+    int id = crew->ids[i];
+    crew_worker *worker = crew_worker_hold(crew->workers[i]);
+    mutex_unlock(&crew->lock, "crew_assign_class");
 
     // send command
-    crew_node *node = get_crew_node(&crew->workers[id % _CREW_MAXLEN], id);
-    json_value *cmd;
-    cmd = json_object_new(0);
-    json_object_push(cmd, "command", json_string_new("run_job"));
-    json_object_push(cmd, "job", job);
-    json_value_free(send_command(node->worker, cmd));
-    json_builder_free(cmd);
-
-    mutex_unlock(&crew->lock, "assign_job");
-    return 0;
+    json_value *res = send_request(worker, req);
+    free(req);
+
+    json_value *job_id = json_get_value(job, "id");
+    mutex_lock(&crew->lock, "crew_assign_class");
+    if (get_worker(crew, id) != worker) {
+        id = -1;
+    } else if (crew_refused(res)) {
+        if (res)
+            fprintf(stderr, "crew: crew_assign_class: Error: Worker %d refused the job\n", id);
+        bit_set(crew->idle, worker->index);
+        id = -1;
+    } else {
+        i = worker->index;
+        crew->status[i] = worker_working;
+        crew->job_ids[i] = (job_id && job_id->type == json_integer) ? job_id->u.integer : -1;
+        crew->job_status[i] = job_running;
+        crew->job_start[i] = crew_now();
+    }
+    mutex_unlock(&crew->lock, "crew_assign_class");
+    crew_worker_release(worker);
+    json_value_free(res);
+    return id;
+}
+
+/* assign_job: Assigns a job to any idle worker in the crew and returns its
+    id. Otherwise, returns -1. */
+int assign_job(Crew *crew, json_value *job) {
+    return crew_assign_class(crew, job, 0);
+}
+
+/* crew_set_classes: Sets the classes of the worker by its id, as a mask with
+    one bit per class. Returns 0 on success, and -1 otherwise. */
+int crew_set_classes(Crew *crew, int id, unsigned int classes) {
+    mutex_lock(&crew->lock, "crew_set_classes");
+    int i = get_index(crew, id);
+    if (i != -1)
+        set_classes(crew, i, classes);
+    mutex_unlock(&crew->lock, "crew_set_classes");
+    return i == -1 ? -1 : 0;
+}
+
+/* crew_idle_count: Returns the number of idle workers in all of the
+    classes. */
+int crew_idle_count(Crew *crew, unsigned int classes) {
+    mutex_lock(&crew->lock, "crew_idle_count");
+    int count = 0;
+    for (int w = 0; w < (crew->len + 63) / 64; w++)
+        count += __builtin_popcountll(idle_word(crew, w, classes));
+    mutex_unlock(&crew->lock, "crew_idle_count");
+    return count;
+}
+
+/* crew_get_health: Gets the health of the worker by its id and returns it.
+    Otherwise, returns -1. */
+int crew_get_health(Crew *crew, int id) {
+    mutex_lock(&crew->lock, "crew_get_health");
+    int i = get_index(crew, id);
+    int health = i == -1 ? -1 : crew->health[i];
+    mutex_unlock(&crew->lock, "crew_get_health");
+    return health;
+}
+
+/* crew_take_orphans: Takes the ids of the jobs that were running on
+    workers found dead, so the manager can assign them again. Returns their
+    number and sets job_ids to them, freed by the caller. */
+int crew_take_orphans(Crew *crew, int **job_ids) {
+    mutex_lock(&crew->lock, "crew_take_orphans");
+    int n = crew->orphans_len;
+    *job_ids = crew->orphans;
+    crew->orphans = NULL;
+    crew->orphans_len = 0;
+    crew->orphans_cap = 0;
+    mutex_unlock(&crew->lock, "crew_take_orphans");
+    return n;
 }
 
-/* unassign_worker: Unassigns the worker from its current job and adds it
-    to the freelist. */
+/* unassign_worker: Unassigns the worker from its current job and marks it
+    idle. A working worker is stopped first, without the crew
+    lock held. */
 int unassign_worker(Crew *crew, int id) {
     mutex_lock(&crew->lock, "unassign_worker");
-
-    if (in_crew(crew, id) == false) {
+    int i = get_index(crew, id);
+    if (i == -1) {
         mutex_unlock(&crew->lock, "unassign_worker");
         return -1;
     }
+    int status = crew->status[i];
+    crew_worker *worker = crew_worker_hold(crew->workers[i]);
+    mutex_unlock(&crew->lock, "unassign_worker");
 
-    Worker *worker = get_worker(crew, id);
-    json_value *cmd;
-    char *stop = "{\"command\":\"stop\"}";
-    switch (worker->status) {
-        /* intentionally falling through :) */
-        case worker_working:
-            cmd = json_parse(stop, strlen(stop));
-            json_value_free(send_command(worker, cmd));
-            json_value_free(cmd);
-        case worker_not_working:
-            freelist_append(crew, id);
-            worker->status = worker_not_assigned;
-            worker->job.id = -1;
-            worker->job.status = -1;
-        case worker_not_assigned:
-            break;
-    }
+    crew_worker_stop(worker, status);
 
+    mutex_lock(&crew->lock, "unassign_worker");
+    i = worker->index;
+    if (status != worker_not_assigned && get_worker(crew, id) == worker &&
+        crew->status[i] != worker_not_assigned) {
+        bit_set(crew->idle, i);
+        crew->status[i] = worker_not_assigned;
+        crew->job_ids[i] = -1;
+        crew->job_status[i] = -1;
+        crew->job_start[i] = 0;
+    }
     mutex_unlock(&crew->lock, "unassign_worker");
+    crew_worker_release(worker);
     return 0;
 }
 
-/* broadcast_command: Sends a command to all workers in the crew. */
-void broadcast_command(Crew *crew, json_value *cmd) {
-    mutex_lock(&crew->lock, "broadcast_command");
+// Broadcast states of a worker
+enum {
+    CREW_CAST_BUSY,         // its connection is in use, not locked yet
+    CREW_CAST_CONNECTING,
+    CREW_CAST_SENDING,
+    CREW_CAST_RECEIVING,
+    CREW_CAST_DONE,
+    CREW_CAST_FAILED
+};
 
-    if (crew->len == 0) {
-        mutex_unlock(&crew->lock, "broadcast_command");
+// Broadcast to one worker, over its persistent connection
+struct crew_cast {
+    crew_worker *worker;
+    int state;
+    size_t sent;            // bytes of the request sent
+    Buffer *in;
+    json_value *response;
+};
+
+/* crew_cast_start: Starts the broadcast to the worker on its connection,
+    connecting without blocking if it is down, and adds the connection to
+    the epoll instance. */
+static void crew_cast_start(struct crew_cast *cast, int epfd, int i) {
+    crew_worker *worker = cast->worker;
+    cast->state = CREW_CAST_FAILED;
+    if ((cast->in = buffer_create(0)) == NULL)
         return;
+    if (worker->fd == -1) {
+        if (worker->failures > 0 && crew_now() < worker->retry_at)
+            return;
+        if ((worker->fd = net_connect_nonblock(&worker->addr)) == -1 ||
+            net_set_timeout(worker->fd, CREW_CALL_TIMEOUT) == -1) {
+            crew_disconnect(worker);
+            return;
+        }
+        cast->state = CREW_CAST_CONNECTING;
+    } else {
+        int flags = fcntl(worker->fd, F_GETFL);
+        if (flags == -1 || fcntl(worker->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            crew_disconnect(worker);
+            return;
+        }
+        cast->state = CREW_CAST_SENDING;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = i;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, worker->fd, &ev) == -1) {
+        perror("crew: crew_cast_start: epoll_ctl");
+        crew_disconnect(worker);
+        cast->state = CREW_CAST_FAILED;
+    }
+}
+
+/* crew_cast_event: Advances the broadcast to the worker on an epoll event.
+    Returns 1 once it is done or failed, and 0 otherwise. */
+static int crew_cast_event(struct crew_cast *cast, int epfd, int i, const char *req, size_t len) {
+    crew_worker *worker = cast->worker;
+    if (cast->state == CREW_CAST_CONNECTING) {
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        if (getsockopt(worker->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1 || err != 0)
+            goto fail;
+        cast->state = CREW_CAST_SENDING;
     }
 
-    crew_list *list;
-    crew_node *curr;
-    for (int i = 0; i < _CREW_MAXLEN; i++) {
-        list = &crew->workers[i];
-        if (list->len == 0)
+    while (cast->state == CREW_CAST_SENDING) {
+        ssize_t nbytes = send(worker->fd, req + cast->sent, len - cast->sent, MSG_NOSIGNAL);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            goto fail;
+        }
+        if ((cast->sent += nbytes) < len)
             continue;
-        curr = list->head;
-        while (curr) {
-            json_value_free(send_command(curr->worker, cmd));
-            curr = curr->next;
+
+        // Only wait for the response from now on
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, worker->fd, &ev) == -1)
+            goto fail;
+        cast->state = CREW_CAST_RECEIVING;
+    }
+
+    for (;;) {
+        if (buffer_reserve(cast->in, 4096) == -1)
+            goto fail;
+        ssize_t nbytes = recv(worker->fd, cast->in->data + cast->in->len,
+            cast->in->capacity - cast->in->len - 1, 0);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            goto fail;
         }
+        if (nbytes == 0)
+            goto fail;
+        cast->in->len += nbytes;
     }
 
+    frame f;
+    switch (frame_next(cast->in->data, cast->in->len, &f)) {
+        case 0:
+            return 0;
+        case -1:
+            goto fail;
+    }
+    if ((cast->response = json_parse(f.body, f.len)) == NULL)
+        fprintf(stderr, "crew: crew_cast_event: Error: Unable to parse response\n");
+    cast->state = CREW_CAST_DONE;
+    worker->failures = 0;
+    return 1;
+
+    fail:
+    cast->state = CREW_CAST_FAILED;
+    crew_disconnect(worker);
+    return 1;
+}
+
+/* crew_cast_finish: Ends the broadcast to the worker and releases its
+    connection. A worker that answered keeps its connection, blocking
+    again. Any other connection is closed, since a late response would be
+    read as the answer to the next command. */
+static void crew_cast_finish(struct crew_cast *cast) {
+    crew_worker *worker = cast->worker;
+    if (cast->state == CREW_CAST_BUSY)
+        return;
+    if (cast->state == CREW_CAST_DONE) {
+        int flags = fcntl(worker->fd, F_GETFL);
+        if (flags == -1 || fcntl(worker->fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+            crew_disconnect(worker);
+    } else if (cast->state != CREW_CAST_FAILED) {
+        crew_disconnect(worker);
+    }
+    buffer_destroy(cast->in);
+    mutex_unlock(&worker->conn, "crew_cast_finish");
+}
+
+/* crew_cast_compare: Orders broadcasts by worker id. */
+static int crew_cast_compare(const void *a, const void *b) {
+    int x = ((const struct crew_cast *)a)->worker->id;
+    int y = ((const struct crew_cast *)b)->worker->id;
+    return (x > y) - (x < y);
+}
+
+/* broadcast_command: Sends a command to all workers in the crew at once and
+    waits up to timeout ms for their responses. The crew lock is only held
+    to take references to the workers, so other crew operations aren't
+    blocked by the network I/O. A worker whose connection stays in use
+    until the deadline is skipped and reported busy. Returns the number of
+    workers and, if results isn't NULL, sets it to their responses in order
+    of worker id, freed with crew_results_free. Otherwise, returns -1. */
+int broadcast_command(Crew *crew, json_value *cmd, long timeout, crew_result **results) {
+    long deadline = crew_now() + timeout;
+    if (results)
+        *results = NULL;
+
+    // Frame the request once for all workers
+    char *body;
+    if ((body = malloc(json_measure(cmd))) == NULL) {
+        perror("crew: broadcast_command: malloc");
+        return -1;
+    }
+    json_serialize(body, cmd);
+    size_t bodylen = strlen(body);
+    char *req;
+    if ((req = malloc(FRAME_HEADER_LEN + bodylen)) == NULL) {
+        perror("crew: broadcast_command: malloc");
+        free(body);
+        return -1;
+    }
+    frame_header_encode(req, bodylen);
+    memcpy(req + FRAME_HEADER_LEN, body, bodylen);
+    size_t len = FRAME_HEADER_LEN + bodylen;
+    free(body);
+
+    int epfd;
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("crew: broadcast_command: epoll_create1");
+        free(req);
+        return -1;
+    }
+
+    // Hold each worker, so none is freed while the crew lock is released
+    mutex_lock(&crew->lock, "broadcast_command");
+    int n = crew->len;
+    struct crew_cast *casts = calloc(n > 0 ? n : 1, sizeof(struct crew_cast));
+    if (casts == NULL) {
+        perror("crew: broadcast_command: calloc");
+        mutex_unlock(&crew->lock, "broadcast_command");
+        close(epfd);
+        free(req);
+        return -1;
+    }
+    int i;
+    for (i = 0; i < n; i++) {
+        casts[i].worker = crew_worker_hold(crew->workers[i]);
+        casts[i].state = CREW_CAST_BUSY;
+    }
     mutex_unlock(&crew->lock, "broadcast_command");
-    return;
+    qsort(casts, n, sizeof(struct crew_cast), crew_cast_compare);
+
+    // Take each worker's connection, so no command interleaves with ours,
+    // and drive them until every worker answered or the deadline. A
+    // connection in use by another command, or another broadcast, is
+    // tried again every CREW_BROADCAST_RETRY ms. The locks are taken in
+    // order of worker id and never waited on, so a hung command can't
+    // block the broadcast past its deadline, and broadcasts can't
+    // deadlock each other.
+    struct epoll_event events[CREW_POLL_EVENTS];
+    int busy = n, active = 0;
+    for (;;) {
+        for (i = 0; busy > 0 && i < n; i++) {
+            if (casts[i].state != CREW_CAST_BUSY ||
+                !mutex_trylock(&casts[i].worker->conn, "broadcast_command"))
+                continue;
+            crew_cast_start(&casts[i], epfd, i);
+            active += casts[i].state != CREW_CAST_FAILED;
+            busy--;
+        }
+        if (active == 0 && busy == 0)
+            break;
+
+        long wait = deadline - crew_now();
+        if (wait <= 0)
+            break;
+        if (busy > 0 && wait > CREW_BROADCAST_RETRY)
+            wait = CREW_BROADCAST_RETRY;
+        int nevents = epoll_wait(epfd, events, CREW_POLL_EVENTS, wait);
+        if (nevents == -1) {
+            if (errno == EINTR) continue;
+            perror("crew: broadcast_command: epoll_wait");
+            break;
+        }
+        for (int e = 0; e < nevents; e++) {
+            int c = events[e].data.u32;
+            struct crew_cast *cast = &casts[c];
+            int fd = cast->worker->fd;
+            if (crew_cast_event(cast, epfd, c, req, len) == 1) {
+                if (cast->state == CREW_CAST_DONE)
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                active--;
+            }
+        }
+    }
+    close(epfd);
+    free(req);
+
+    crew_result *res = (results && n > 0) ? malloc(n * sizeof(crew_result)) : NULL;
+    for (i = 0; i < n; i++) {
+        crew_cast_finish(&casts[i]);
+        if (res) {
+            res[i].id = casts[i].worker->id;
+            res[i].busy = casts[i].state == CREW_CAST_BUSY;
+            res[i].response = casts[i].response;
+        } else {
+            json_value_free(casts[i].response);
+        }
+        crew_worker_release(casts[i].worker);
+    }
+    free(casts);
+    if (results)
+        *results = res;
+    return n;
+}
+
+/* crew_results_free: Frees the broadcast results. */
+void crew_results_free(crew_result *results, int n) {
+    if (results == NULL)
+        return;
+    for (int i = 0; i < n; i++)
+        json_value_free(results[i].response);
+    free(results);
 }
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "frame.h"
+
+/* frame_header_decode: Decodes the body length from the frame header. */
+static size_t frame_header_decode(const char* data) {
+    uint32_t n;
+    memcpy(&n, data, FRAME_HEADER_LEN);
+    return ntohl(n);
+}
+
+/* frame_header_encode: Encodes the body length into the frame header. */
+void frame_header_encode(char* data, size_t len) {
+    uint32_t n = htonl((uint32_t)len);
+    memcpy(data, &n, FRAME_HEADER_LEN);
+}
+
+/* frame_json_len: Returns the length of the JSON object at the start of
+    data, or 0 if the object is not terminated within len bytes. */
+static size_t frame_json_len(const char* data, size_t len) {
+    int depth = 0, in_string = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (in_string) {
+            if (c == '\\') i++;
+            else if (c == '"') in_string = 0;
+            continue;
+        }
+        switch (c) {
+            case '"':
+                in_string = 1;
+                break;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) return i + 1;
+                break;
+        }
+    }
+    return 0;
+}
+
+/* frame_space: Returns the number of ASCII whitespace bytes at the start
+    of data. */
+static size_t frame_space(const char* data, size_t len) {
+    size_t n = 0;
+    while (n < len && (data[n] == ' ' || data[n] == '\t' || data[n] == '\r' ||
+        data[n] == '\n' || data[n] == '\v' || data[n] == '\f'))
+        n++;
+    return n;
+}
+
+/* frame_next: Finds the next message in the data. Returns 1 and fills in the
+    frame, if data starts with a complete message, 0 if more bytes are needed,
+    and -1 if the frame header is invalid. */
+int frame_next(char* data, size_t len, frame* f) {
+    if (len == 0) return 0;
+
+    // Legacy clients send unframed JSON objects, wait for the object to
+    // close. Whitespace around them is taken with the object, and no valid
+    // header starts with a whitespace byte, as its length would be over
+    // FRAME_MAXLEN.
+    size_t skip = frame_space(data, len);
+    if (skip == len) return 0;
+    if (data[skip] == '{') {
+        size_t n = frame_json_len(data + skip, len - skip);
+        if (n == 0) return (len - skip > FRAME_MAXLEN) ? -1 : 0;
+        f->body = data + skip;
+        f->len = n;
+        f->size = skip + n + frame_space(data + skip + n, len - skip - n);
+        f->framed = 0;
+        return 1;
+    }
+
+    if (len < FRAME_HEADER_LEN) return 0;
+    size_t n = frame_header_decode(data);
+    if (n > FRAME_MAXLEN) return -1;
+    if (len - FRAME_HEADER_LEN < n) return 0;
+
+    f->body = data + FRAME_HEADER_LEN;
+    f->len = n;
+    f->size = FRAME_HEADER_LEN + n;
+    f->framed = 1;
+    return 1;
+}
+
+/* frame_push: Appends the body to the buffer as a frame. Returns 0 on
+    success, and -1 otherwise. */
+int frame_push(Buffer* buffer, const char* body, size_t len) {
+    if (len > FRAME_MAXLEN) return -1;
+    if (buffer_reserve(buffer, FRAME_HEADER_LEN + len) == -1) return -1;
+
+    frame_header_encode(buffer->data + buffer->len, len);
+    memcpy(buffer->data + buffer->len + FRAME_HEADER_LEN, body, len);
+    buffer->len += FRAME_HEADER_LEN + len;
+    return 0;
+}
+
+/* send_all: Sends len bytes on the socket. Returns 0 on success, and -1
+    otherwise. */
+static int send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t nbytes = send(fd, data, len, MSG_NOSIGNAL);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+
+/* recv_all: Receives exactly len bytes from the socket. Returns 0 on
+    success, and -1 otherwise. */
+static int recv_all(int fd, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t nbytes = recv(fd, data, len, 0);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (nbytes == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        data += nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+
+/* frame_send: Sends the body as a single frame on a blocking socket. Returns
+    0 on success, and -1 otherwise. */
+int frame_send(int fd, const char* body, size_t len) {
+    if (len > FRAME_MAXLEN) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    char hdr[FRAME_HEADER_LEN];
+    frame_header_encode(hdr, len);
+    if (send_all(fd, hdr, FRAME_HEADER_LEN) == -1) return -1;
+    return send_all(fd, body, len);
+}
+
+/* frame_recv: Receives a single frame from a blocking socket and returns
+    its null terminated body. The caller frees the body. Otherwise, returns
+    NULL. */
+char* frame_recv(int fd, size_t* len) {
+    char hdr[FRAME_HEADER_LEN];
+    if (recv_all(fd, hdr, FRAME_HEADER_LEN) == -1) return NULL;
+
+    size_t n = frame_header_decode(hdr);
+    if (n > FRAME_MAXLEN) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    char* body = malloc(n + 1);
+    if (body == NULL) return NULL;
+    if (recv_all(fd, body, n) == -1) {
+        free(body);
+        return NULL;
+    }
+    body[n] = '\0';
+    if (len) *len = n;
+    return body;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "histogram.h"
+
+/* histogram_index: Returns the index of the bucket the value falls in. */
+static int histogram_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB) return value;
+
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HISTOGRAM_MAX_BITS) return HISTOGRAM_LEN - 1;
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    return shift * HISTOGRAM_SUB + (value >> shift);
+}
+
+/* histogram_value: Returns the largest value counted in the bucket. */
+static uint64_t histogram_value(int index) {
+    if (index < 2 * HISTOGRAM_SUB) return index;
+
+    int shift = index / HISTOGRAM_SUB - 1;
+    uint64_t mantissa = index - shift * HISTOGRAM_SUB;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/* histogram_create: Creates a new empty histogram. */
+Histogram* histogram_create(void) {
+    Histogram* histogram = malloc(sizeof(Histogram));
+    if (histogram == NULL) {
+        perror("histogram_create: malloc");
+        return NULL;
+    }
+
+    atomic_init(&histogram->count, 0);
+    for (int i = 0; i < HISTOGRAM_LEN; i++)
+        atomic_init(&histogram->buckets[i], 0);
+    return histogram;
+}
+
+/* histogram_destroy: Frees the histogram. */
+void histogram_destroy(Histogram* histogram) {
+    free(histogram);
+}
+
+/* histogram_record: Records the value. */
+void histogram_record(Histogram* histogram, uint64_t value) {
+    atomic_fetch_add_explicit(&histogram->buckets[histogram_index(value)], 1,
+        memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+}
+
+/* histogram_count: Returns the number of recorded values. */
+uint64_t histogram_count(Histogram* histogram) {
+    return atomic_load_explicit(&histogram->count, memory_order_relaxed);
+}
+
+/* histogram_percentile: Returns the value at the percentile (0 to 100) of
+    the recorded values, rounded up to the end of its bucket. Returns 0 if
+    no values were recorded. */
+uint64_t histogram_percentile(Histogram* histogram, double percentile) {
+    uint64_t count = histogram_count(histogram);
+    if (count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_LEN; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= rank) return histogram_value(i);
+    }
+    return histogram_value(HISTOGRAM_LEN - 1);
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "idmap.h"
+
+/* idmap_slot_of: Returns the home slot of the id (Fibonacci hashing). */
+static size_t idmap_slot_of(const IdMap* map, int id) {
+    return (size_t)(((uint64_t)(unsigned int)id * 0x9E3779B97F4A7C15ull) >> 32) & (map->capacity - 1);
+}
+
+/* idmap_alloc: Allocates capacity empty slots. Returns NULL on failure. */
+static idmap_slot* idmap_alloc(size_t capacity) {
+    idmap_slot* slots = malloc(capacity * sizeof(idmap_slot));
+    if (slots == NULL) {
+        perror("idmap_alloc: malloc");
+        return NULL;
+    }
+    for (size_t i = 0; i < capacity; i++)
+        slots[i].id = -1;
+    return slots;
+}
+
+/* idmap_create: Creates a new empty map with room for capacity ids before
+    it grows. */
+IdMap* idmap_create(size_t capacity) {
+    IdMap* map = malloc(sizeof(IdMap));
+    if (map == NULL) {
+        perror("idmap_create: malloc");
+        return NULL;
+    }
+
+    map->capacity = IDMAP_MINCAP;
+    while (map->capacity < 2 * capacity)
+        map->capacity *= 2;
+    map->len = 0;
+    if ((map->slots = idmap_alloc(map->capacity)) == NULL) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+/* idmap_destroy: Frees the map. */
+void idmap_destroy(IdMap* map) {
+    if (map == NULL) return;
+    free(map->slots);
+    free(map);
+}
+
+/* idmap_get: Returns the index of the id. Otherwise, returns -1. */
+int idmap_get(const IdMap* map, int id) {
+    size_t mask = map->capacity - 1;
+    for (size_t i = idmap_slot_of(map, id); map->slots[i].id != -1; i = (i + 1) & mask)
+        if (map->slots[i].id == id)
+            return map->slots[i].index;
+    return -1;
+}
+
+/* idmap_grow: Doubles the number of slots and rehashes the ids. Returns 0
+    on success, and -1 otherwise. */
+static int idmap_grow(IdMap* map) {
+    idmap_slot* old = map->slots;
+    size_t capacity = map->capacity;
+    if ((map->slots = idmap_alloc(2 * capacity)) == NULL) {
+        map->slots = old;
+        return -1;
+    }
+
+    map->capacity = 2 * capacity;
+    size_t mask = map->capacity - 1;
+    for (size_t j = 0; j < capacity; j++) {
+        if (old[j].id == -1) continue;
+        size_t i = idmap_slot_of(map, old[j].id);
+        while (map->slots[i].id != -1)
+            i = (i + 1) & mask;
+        map->slots[i] = old[j];
+    }
+    free(old);
+    return 0;
+}
+
+/* idmap_put: Maps the id to the index, replacing its old index. Returns 0
+    on success, and -1 otherwise. */
+int idmap_put(IdMap* map, int id, int index) {
+    if (id < 0) return -1;
+
+    size_t mask = map->capacity - 1;
+    size_t i = idmap_slot_of(map, id);
+    while (map->slots[i].id != -1) {
+        if (map->slots[i].id == id) {
+            map->slots[i].index = index;
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+
+    // A new id, grow first if that would fill more than half the slots
+    if (2 * (map->len + 1) > map->capacity) {
+        if (idmap_grow(map) == -1) return -1;
+        mask = map->capacity - 1;
+        i = idmap_slot_of(map, id);
+        while (map->slots[i].id != -1)
+            i = (i + 1) & mask;
+    }
+    map->slots[i].id = id;
+    map->slots[i].index = index;
+    map->len++;
+    return 0;
+}
+
+/* idmap_remove: Removes the id and returns its index. Otherwise, returns
+    -1. */
+int idmap_remove(IdMap* map, int id) {
+    size_t mask = map->capacity - 1;
+    size_t i = idmap_slot_of(map, id);
+    while (map->slots[i].id != id) {
+        if (map->slots[i].id == -1) return -1;
+        i = (i + 1) & mask;
+    }
+    int index = map->slots[i].index;
+
+    // Shift back each following entry that would no longer be reachable
+    // from its home slot across the hole
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; map->slots[j].id != -1; j = (j + 1) & mask) {
+        size_t home = idmap_slot_of(map, map->slots[j].id);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            map->slots[hole] = map->slots[j];
+            hole = j;
+        }
+    }
+    map->slots[hole].id = -1;
+    map->len--;
+    return index;
+}
@@ -46,6 +46,57 @@ static const json_serialize_opts default_opts =
    3  /* indent_size */
 };
 
+#ifdef _MSC_VER
+   #define json_thread_local __declspec(thread)
+#else
+   #define json_thread_local _Thread_local
+#endif
+
+static json_thread_local json_builder_settings builder_settings;
+
+void json_builder_set_settings (const json_builder_settings * settings)
+{
+   if (settings)
+      builder_settings = *settings;
+   else
+      memset (&builder_settings, 0, sizeof (builder_settings));
+}
+
+static void * builder_malloc (size_t size)
+{
+   if (builder_settings.mem_alloc)
+      return builder_settings.mem_alloc (size, 0, builder_settings.user_data);
+
+   return malloc (size);
+}
+
+static void * builder_calloc (size_t count, size_t size)
+{
+   if (builder_settings.mem_alloc)
+      return builder_settings.mem_alloc (count * size, 1, builder_settings.user_data);
+
+   return calloc (count, size);
+}
+
+static void * builder_realloc (void * ptr, size_t size)
+{
+   if (builder_settings.mem_realloc)
+      return builder_settings.mem_realloc (ptr, size, builder_settings.user_data);
+
+   return realloc (ptr, size);
+}
+
+static void builder_free (void * ptr)
+{
+   if (builder_settings.mem_free)
+   {
+      builder_settings.mem_free (ptr, builder_settings.user_data);
+      return;
+   }
+
+   free (ptr);
+}
+
 typedef struct json_builder_value
 {
    json_value value;
@@ -76,7 +127,7 @@ static int builderize (json_value * value)
          json_char * name_copy;
          json_object_entry * entry = &value->u.object.values [i];
 
-         if (! (name_copy = (json_char *) malloc ((entry->name_length + 1) * sizeof (json_char))))
+         if (! (name_copy = (json_char *) builder_malloc ((entry->name_length + 1) * sizeof (json_char))))
             return 0;
 
          memcpy (name_copy, entry->name, entry->name_length + 1);
@@ -128,7 +179,7 @@ static int get_serialize_flags (json_serialize_opts opts)
 
 json_value * json_array_new (size_t length)
 {
-    json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+    json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
 
     if (!value)
        return NULL;
@@ -137,9 +188,9 @@ json_value * json_array_new (size_t length)
 
     value->type = json_array;
 
-    if (! (value->u.array.values = (json_value **) malloc (length * sizeof (json_value *))))
+    if (! (value->u.array.values = (json_value **) builder_malloc (length * sizeof (json_value *))))
     {
-       free (value);
+       builder_free (value);
        return NULL;
     }
 
@@ -161,7 +212,7 @@ json_value * json_array_push (json_value * array, json_value * value)
    }
    else
    {
-      json_value ** values_new = (json_value **) realloc
+      json_value ** values_new = (json_value **) builder_realloc
             (array->u.array.values, sizeof (json_value *) * (array->u.array.length + 1));
 
       if (!values_new)
@@ -180,7 +231,7 @@ json_value * json_array_push (json_value * array, json_value * value)
 
 json_value * json_object_new (size_t length)
 {
-    json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+    json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
 
     if (!value)
        return NULL;
@@ -189,10 +240,10 @@ json_value * json_object_new (size_t length)
 
     value->type = json_object;
 
-    if (! (value->u.object.values = (json_object_entry *) calloc
+    if (! (value->u.object.values = (json_object_entry *) builder_calloc
            (length, sizeof (*value->u.object.values))))
     {
-       free (value);
+       builder_free (value);
        return NULL;
     }
 
@@ -216,7 +267,7 @@ json_value * json_object_push_length (json_value * object,
 
    assert (object->type == json_object);
 
-   if (! (name_copy = (json_char *) malloc ((name_length + 1) * sizeof (json_char))))
+   if (! (name_copy = (json_char *) builder_malloc ((name_length + 1) * sizeof (json_char))))
       return NULL;
    
    memcpy (name_copy, name, name_length * sizeof (json_char));
@@ -224,7 +275,7 @@ json_value * json_object_push_length (json_value * object,
 
    if (!json_object_push_nocopy (object, name_length, name_copy, value))
    {
-      free (name_copy);
+      builder_free (name_copy);
       return NULL;
    }
 
@@ -249,7 +300,7 @@ json_value * json_object_push_nocopy (json_value * object,
    else
    {
       json_object_entry * values_new = (json_object_entry *)
-            realloc (object->u.object.values, sizeof (*object->u.object.values)
+            builder_realloc (object->u.object.values, sizeof (*object->u.object.values)
                             * (object->u.object.length + 1));
 
       if (!values_new)
@@ -279,7 +330,7 @@ json_value * json_string_new (const json_char * buf)
 json_value * json_string_new_length (unsigned int length, const json_char * buf)
 {
    json_value * value;
-   json_char * copy = (json_char *) malloc ((length + 1) * sizeof (json_char));
+   json_char * copy = (json_char *) builder_malloc ((length + 1) * sizeof (json_char));
 
    if (!copy)
       return NULL;
@@ -289,7 +340,7 @@ json_value * json_string_new_length (unsigned int length, const json_char * buf)
 
    if (! (value = json_string_new_nocopy (length, copy)))
    {
-      free (copy);
+      builder_free (copy);
       return NULL;
    }
 
@@ -298,7 +349,7 @@ json_value * json_string_new_length (unsigned int length, const json_char * buf)
 
 json_value * json_string_new_nocopy (unsigned int length, json_char * buf)
 {
-   json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+   json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
    
    if (!value)
       return NULL;
@@ -314,7 +365,7 @@ json_value * json_string_new_nocopy (unsigned int length, json_char * buf)
 
 json_value * json_integer_new (json_int_t integer)
 {
-   json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+   json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
    
    if (!value)
       return NULL;
@@ -329,7 +380,7 @@ json_value * json_integer_new (json_int_t integer)
 
 json_value * json_double_new (double dbl)
 {
-   json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+   json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
    
    if (!value)
       return NULL;
@@ -344,7 +395,7 @@ json_value * json_double_new (double dbl)
 
 json_value * json_boolean_new (int b)
 {
-   json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+   json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
    
    if (!value)
       return NULL;
@@ -359,7 +410,7 @@ json_value * json_boolean_new (int b)
 
 json_value * json_null_new (void)
 {
-   json_value * value = (json_value *) calloc (1, sizeof (json_builder_value));
+   json_value * value = (json_value *) builder_calloc (1, sizeof (json_builder_value));
    
    if (!value)
       return NULL;
@@ -431,7 +482,7 @@ json_value * json_object_merge (json_value * objectA, json_value * objectB)
               + objectB->u.object.length;
 
       if (! (values_new = (json_object_entry *)
-            realloc (objectA->u.object.values, sizeof (json_object_entry) * alloc)))
+            builder_realloc (objectA->u.object.values, sizeof (json_object_entry) * alloc)))
       {
           return NULL;
       }
@@ -449,8 +500,8 @@ json_value * json_object_merge (json_value * objectA, json_value * objectB)
 
    objectA->u.object.length += objectB->u.object.length;
 
-   free (objectB->u.object.values);
-   free (objectB);
+   builder_free (objectB->u.object.values);
+   builder_free (objectB);
 
    return objectA;
 }
@@ -944,7 +995,7 @@ void json_builder_free (json_value * value)
 
             if (!value->u.array.length)
             {
-               free (value->u.array.values);
+               builder_free (value->u.array.values);
                break;
             }
 
@@ -955,7 +1006,7 @@ void json_builder_free (json_value * value)
 
             if (!value->u.object.length)
             {
-               free (value->u.object.values);
+               builder_free (value->u.object.values);
                break;
             }
 
@@ -967,7 +1018,7 @@ void json_builder_free (json_value * value)
                 * values, they are part of the same allocation as the values array
                 * itself.
                 */
-               free (value->u.object.values [value->u.object.length].name);
+               builder_free (value->u.object.values [value->u.object.length].name);
             }
 
             value = value->u.object.values [value->u.object.length].value;
@@ -975,7 +1026,7 @@ void json_builder_free (json_value * value)
 
          case json_string:
 
-            free (value->u.string.ptr);
+            builder_free (value->u.string.ptr);
             break;
 
          default:
@@ -984,7 +1035,7 @@ void json_builder_free (json_value * value)
 
       cur_value = value;
       value = value->parent;
-      free (cur_value);
+      builder_free (cur_value);
    }
 }
 
@@ -9,6 +9,19 @@
 #define ROLE 1
 #define LEVEL 2
 
+/* set_rate_limit: Sets the rate limit of the class from a "rate[:burst]"
+    value, the burst defaults to one second of requests. Returns 0 on
+    success or if the value is NULL, and -1 otherwise. */
+static int set_rate_limit(Api* server, ApiClass cls, const char* value) {
+    if (value == NULL) return 0;
+    char* end;
+    double rate = strtod(value, &end);
+    double burst = rate < 1 ? 1 : rate;
+    if (*end == ':') burst = strtod(end + 1, &end);
+    if (*end != '\0') return -1;
+    return api_set_rate_limit(server, cls, rate, burst);
+}
+
 int main(int argc, char *argv[]) {
     // Check argument count
     if (argc == 5) {
@@ -59,6 +72,61 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // Select the socket I/O backend, epoll is the default
+    char* backend = getenv("PYONEER_API_BACKEND");
+    if (backend && strcmp(backend, "io_uring") == 0)
+        api_set_backend(server, API_BACKEND_URING);
+
+    // Also listen on TCP, for crews on other hosts
+    char* tcp_addr = getenv("PYONEER_TCP_ADDR");
+    if (tcp_addr && api_set_tcp(server, tcp_addr) == -1) {
+        fprintf(stderr, "main: Error: Unable to set TCP address\n");
+        api_destroy(server);
+        pyoneer_destroy(pyoneer);
+        logger_destroy(logger);
+        exit(EXIT_FAILURE);
+    }
+
+    // Spread TCP connections across listener threads
+    char* listeners = getenv("PYONEER_API_LISTENERS");
+    if (listeners && api_set_listeners(server, atoi(listeners)) == -1) {
+        fprintf(stderr, "main: Error: Unable to set API listeners\n");
+        api_destroy(server);
+        pyoneer_destroy(pyoneer);
+        logger_destroy(logger);
+        exit(EXIT_FAILURE);
+    }
+
+    // Bound the time in-flight requests get to finish on shutdown
+    char* drain = getenv("PYONEER_API_DRAIN_MS");
+    if (drain && api_set_drain_timeout(server, atol(drain)) == -1) {
+        fprintf(stderr, "main: Error: Unable to set API drain timeout\n");
+        api_destroy(server);
+        pyoneer_destroy(pyoneer);
+        logger_destroy(logger);
+        exit(EXIT_FAILURE);
+    }
+
+    // Limit the request rate of each connection, per command class
+    if (set_rate_limit(server, API_CLASS_READ, getenv("PYONEER_API_READ_RATE")) == -1 ||
+        set_rate_limit(server, API_CLASS_CONTROL, getenv("PYONEER_API_CONTROL_RATE")) == -1) {
+        fprintf(stderr, "main: Error: Unable to set API rate limits\n");
+        api_destroy(server);
+        pyoneer_destroy(pyoneer);
+        logger_destroy(logger);
+        exit(EXIT_FAILURE);
+    }
+
+    // Take over the sockets of a running pyoneer on hot restarts
+    char* handoff = getenv("PYONEER_API_HANDOFF");
+    if (handoff && api_set_handoff(server, handoff) == -1) {
+        fprintf(stderr, "main: Error: Unable to set API handoff path\n");
+        api_destroy(server);
+        pyoneer_destroy(pyoneer);
+        logger_destroy(logger);
+        exit(EXIT_FAILURE);
+    }
+
     // Start server
     if (api_start(server) == -1) {
         fprintf(stderr, "main: Error: Unable to start server\n");
@@ -22,6 +22,11 @@ typedef struct _report {
     } u;
 } Report;
 
+/* bump: Bumps the manager's state version, after a status change. */
+static void bump(Manager *man) {
+    atomic_fetch_add_explicit(&man->version, 1, memory_order_release);
+}
+
 /* init_queue: Initializes the queue. */
 static void init_queue(queue *q) {
     q->head = NULL;
@@ -140,6 +145,7 @@ static void bind_project(RunningProject *rproj, Project *proj) {
         }
     }
     rproj->manager->status = _MANAGER_ASSIGNED;
+    bump(rproj->manager);
     return;
 }
 
@@ -147,6 +153,7 @@ static void bind_project(RunningProject *rproj, Project *proj) {
     manager status to not assigned, and returns the project. */
 static Project *unbind_project(RunningProject *rproj) {
     rproj->manager->status = _MANAGER_NOT_ASSIGNED;
+    bump(rproj->manager);
     free_queue(&rproj->not_ready_jobs);
     free_queue(&rproj->ready_jobs);
     free_queue(&rproj->running_jobs);
@@ -182,6 +189,7 @@ Manager *create_manager(int id) {
         perror("manager: create_manager: sem_init");
         exit(EXIT_FAILURE);
     }
+    atomic_init(&man->version, 0);
     return man;
 }
 
@@ -221,6 +229,12 @@ int get_project_status(Manager *man) {
     return status;
 }
 
+/* manager_get_version: Returns the manager's state version. The manager
+    and project statuses can only have changed if the version has. */
+unsigned int manager_get_version(Manager *man) {
+    return atomic_load_explicit(&man->version, memory_order_acquire);
+}
+
 /* sync_project: Synchronizes the project job statuses with the crew job
     job statuses. */
 static void sync_project(Manager *man) {
@@ -233,28 +247,22 @@ static void sync_project(Manager *man) {
     }
     
     Job *job;
-    crew_node *curr;
-    for (int i = 0; i < _CREW_MAXLEN; i++) {
-        curr = &man->crew->workers[i % _CREW_MAXLEN].head;
-        while (curr) {
-            if (curr->worker->status == worker_not_assigned) {
-                curr = curr->next;
-                continue;
-            }
+    Crew *crew = man->crew;
+    for (int i = 0; i < crew->len; i++) {
+        if (crew->status[i] == worker_not_assigned)
+            continue;
 
-            job = get_job(proj, curr->worker->job.id);
-            switch (curr->worker->job.status) {
-                case job_running:
-                    job->status = _JOB_RUNNING;
-                    break;
-                case job_completed:
-                    job->status = _JOB_COMPLETED;
-                    break;
-                case job_incomplete:
-                    job->status = _JOB_INCOMPLETE;
-                    break;
-            }
-            curr = curr->next;
+        job = get_job(proj, crew->job_ids[i]);
+        switch (crew->job_status[i]) {
+            case job_running:
+                job->status = _JOB_RUNNING;
+                break;
+            case job_completed:
+                job->status = _JOB_COMPLETED;
+                break;
+            case job_incomplete:
+                job->status = _JOB_INCOMPLETE;
+                break;
         }
     }
 
@@ -265,6 +273,22 @@ static void sync_project(Manager *man) {
     return;
 }
 
+/* requeue_jobs: Makes the running jobs of dead workers ready again, so
+    they are assigned to other workers. */
+static void requeue_jobs(Manager *man) {
+    Project *proj = man->running_project->project;
+
+    int *job_ids;
+    int n = crew_take_orphans(man->crew, &job_ids);
+    for (int i = 0; i < n; i++) {
+        Job *job = get_job(proj, job_ids[i]);
+        if (job && job->status == _JOB_RUNNING)
+            job->status = _JOB_READY;
+    }
+    free(job_ids);
+    return;
+}
+
 /* status_handler: */
 static void *status_handler(void *arg) {
     Manager *man = (Manager *) arg;
@@ -273,6 +297,7 @@ static void *status_handler(void *arg) {
     if (man->running_project->project->status == _PROJECT_RUNNING)
         man->running_project->project->status = _PROJECT_INCOMPLETE;
     man->status = _MANAGER_NOT_WORKING;
+    bump(man);
     return NULL;
 }
 
@@ -282,7 +307,7 @@ static void *stop_workers_handler(void *arg) {
     json_value *cmd;
     cmd = json_object_new(0);
     json_object_push(cmd, "command", json_string_new("stop"));
-    broadcast_command(man->crew, cmd);
+    broadcast_command(man->crew, cmd, CREW_BROADCAST_TIMEOUT, NULL);
     json_value_free(cmd);
     return NULL;
 }
@@ -786,6 +811,7 @@ static void *project_thread(void *args) {
     Manager *man = rproj->manager;
     Project *proj = rproj->project;
     proj->status = _PROJECT_RUNNING;
+    bump(man);
 
     // Add cleanup handlers
     pthread_cleanup_push(status_handler, man);
@@ -797,6 +823,7 @@ static void *project_thread(void *args) {
     while (sleep(1) == 0) {
         // Synchronzie project with crew
         sync_project(man);
+        requeue_jobs(man);
 
         // Schedule not ready jobs
         for (curr = rproj->not_ready_jobs.head; curr; curr = curr->next) {
@@ -838,6 +865,10 @@ static void *project_thread(void *args) {
                     add_node(&rproj->incomplete_jobs, remove_node(&rproj->running_jobs, curr));
                     unassign_worker(man->crew, curr->worker_id);
                     break;
+                case _JOB_READY:
+                    // Its worker died
+                    add_node(&rproj->ready_jobs, remove_node(&rproj->running_jobs, curr));
+                    break;
                 default:
                     fprintf(stderr, "manager: project_thread: Warning: Schedule is in inconsitent state\n");
                     break;             
@@ -847,9 +878,11 @@ static void *project_thread(void *args) {
         // Update project status
         if (rproj->incomplete_jobs.len > 0) {
             proj->status = _PROJECT_INCOMPLETE;
+            bump(man);
             break;
         } else if (rproj->completed_jobs.len == proj->len) {
             proj->status = _PROJECT_COMPLETED;
+            bump(man);
             break;
         }
         
@@ -887,6 +920,7 @@ int run_project(Manager *man, Project *proj) {
     if (audit_project(proj) == -1) {
         fprintf(stderr, "manager: run_project: audit_project: Project has circular dependencies\n");
         proj->status = _PROJECT_NOT_READY;
+        bump(man);
         ret = -1;
         goto unlock;
     }
@@ -902,6 +936,7 @@ int run_project(Manager *man, Project *proj) {
         exit(EXIT_FAILURE);
     }
     man->status = _MANAGER_WORKING;
+    bump(man);
 
     unlock:
     if (sem_post(&man->lock) == -1) {
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "net.h"
+
+/* net_split: Splits "host:port" or "[host]:port" into its host and port.
+    An empty host means any address. Returns 0 on success, and -1 if there
+    is no port or the host doesn't fit. */
+static int net_split(const char* hostport, char* host, size_t size, const char** port) {
+    const char* colon = strrchr(hostport, ':');
+    if (colon == NULL || colon[1] == '\0') return -1;
+
+    const char* start = hostport;
+    const char* end = colon;
+    if (*start == '[') {
+        if (end == start || end[-1] != ']') return -1;
+        start++;
+        end--;
+    }
+    size_t len = end - start;
+    if (len >= size) return -1;
+    memcpy(host, start, len);
+    host[len] = '\0';
+    *port = colon + 1;
+    return 0;
+}
+
+/* net_resolve: Resolves "host:port" and returns the addresses to free with
+    freeaddrinfo. Otherwise, returns NULL. */
+static struct addrinfo* net_resolve(const char* hostport, int passive) {
+    char host[NI_MAXHOST];
+    const char* port;
+    if (net_split(hostport, host, sizeof(host), &port) == -1) {
+        fprintf(stderr, "net_resolve: Error: Invalid address %s\n", hostport);
+        return NULL;
+    }
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    struct addrinfo* res;
+    int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "net_resolve: getaddrinfo: %s\n", gai_strerror(err));
+        return NULL;
+    }
+    return res;
+}
+
+/* net_nodelay: Disables Nagle's algorithm on TCP sockets, so small requests
+    and responses are sent right away. */
+static int net_nodelay(int fd, int family) {
+    if (family != AF_INET && family != AF_INET6) return 0;
+    int on = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1) {
+        perror("net_nodelay: setsockopt");
+        return -1;
+    }
+    return 0;
+}
+
+/* net_addr_unix: Sets addr to the local socket path. Returns 0 on success,
+    and -1 if the path is too long. */
+int net_addr_unix(net_addr* addr, const char* path) {
+    struct sockaddr_un* sun = (struct sockaddr_un*)&addr->ss;
+    if (strlen(path) >= sizeof(sun->sun_path)) {
+        fprintf(stderr, "net_addr_unix: Error: Path too long %s\n", path);
+        return -1;
+    }
+    memset(&addr->ss, 0, sizeof(addr->ss));
+    sun->sun_family = AF_LOCAL;
+    strcpy(sun->sun_path, path);
+    addr->len = sizeof(struct sockaddr_un);
+    return 0;
+}
+
+/* net_addr_tcp: Resolves "host:port" (or "[host]:port") into addr. Returns
+    0 on success, and -1 otherwise. */
+int net_addr_tcp(net_addr* addr, const char* hostport) {
+    struct addrinfo* res = net_resolve(hostport, 0);
+    if (res == NULL) return -1;
+    memcpy(&addr->ss, res->ai_addr, res->ai_addrlen);
+    addr->len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* net_set_timeout: Sets the timeout ms of blocking sends and receives on
+    the socket, after which they fail with EAGAIN, or none for 0. Returns 0
+    on success, and -1 otherwise. */
+int net_set_timeout(int fd, long timeout) {
+    struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) {
+        perror("net_set_timeout: setsockopt");
+        return -1;
+    }
+    return 0;
+}
+
+/* net_connect: Connects a new stream socket to the address and returns it.
+    TCP sockets have TCP_NODELAY set. Otherwise, returns -1. */
+int net_connect(const net_addr* addr) {
+    return net_connect_timeout(addr, 0);
+}
+
+/* net_connect_timeout: Connects a new stream socket to the address like
+    net_connect, but gives up after timeout ms, and sets the same timeout
+    on the socket's sends and receives. Otherwise, returns -1. */
+int net_connect_timeout(const net_addr* addr, long timeout) {
+    int family = addr->ss.ss_family;
+    int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("net_connect_timeout: socket");
+        return -1;
+    }
+
+    if (net_nodelay(fd, family) == -1 ||
+        (timeout > 0 && net_set_timeout(fd, timeout) == -1)) {
+        close(fd);
+        return -1;
+    }
+
+    // connect is bounded by the send timeout
+    if (connect(fd, (const struct sockaddr*)&addr->ss, addr->len) == -1) {
+        perror("net_connect_timeout: connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* net_connect_nonblock: Starts connecting a new non-blocking stream socket
+    to the address and returns it. The connection may still be in progress,
+    in which case the socket becomes writable once it completes, and
+    SO_ERROR has the result. Otherwise, returns -1. */
+int net_connect_nonblock(const net_addr* addr) {
+    int family = addr->ss.ss_family;
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("net_connect_nonblock: socket");
+        return -1;
+    }
+
+    if (net_nodelay(fd, family) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, (const struct sockaddr*)&addr->ss, addr->len) == -1 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* net_listen_tcp: Creates a non-blocking TCP socket listening on
+    "host:port" and returns it. Sockets accepted from it inherit
+    TCP_NODELAY. With reuseport, several sockets can listen on the same
+    address and the kernel spreads new connections across them. Otherwise,
+    returns -1. */
+int net_listen_tcp(const char* hostport, int backlog, int reuseport) {
+    struct addrinfo* res = net_resolve(hostport, 1);
+    if (res == NULL) return -1;
+
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) continue;
+
+        int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+            (!reuseport ||
+             setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == 0) &&
+            net_nodelay(fd, ai->ai_family) == 0 &&
+            bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+            listen(fd, backlog) == 0)
+            break;
+
+        perror("net_listen_tcp: bind");
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Control message buffer, aligned for its header
+union net_control {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * NET_MAXFDS)];
+};
+
+/* net_send_fds: Sends copies of the fds over the local socket. Returns 0 on
+    success, and -1 otherwise. */
+int net_send_fds(int sock, const int* fds, int n) {
+    if (n < 1 || n > NET_MAXFDS) {
+        fprintf(stderr, "net_send_fds: Error: Invalid number of fds %d\n", n);
+        return -1;
+    }
+
+    // At least one byte of data has to carry the fds
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union net_control control;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+        perror("net_send_fds: sendmsg");
+        return -1;
+    }
+    return 0;
+}
+
+/* net_recv_fds: Receives up to max fds sent over the local socket, in the
+    order they were sent, with close-on-exec set. Returns the number of fds
+    received, and -1 otherwise. */
+int net_recv_fds(int sock, int* fds, int max) {
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union net_control control;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t nbytes = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (nbytes == -1) {
+        perror("net_recv_fds: recvmsg");
+        return -1;
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (nbytes == 0 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        fprintf(stderr, "net_recv_fds: Error: No fds received\n");
+        return -1;
+    }
+
+    int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int* data = (int*)CMSG_DATA(cmsg);
+    if (n > max || (msg.msg_flags & MSG_CTRUNC)) {
+        fprintf(stderr, "net_recv_fds: Error: Too many fds received\n");
+        for (int i = 0; i < n; i++)
+            close(data[i]);
+        return -1;
+    }
+    memcpy(fds, data, sizeof(int) * n);
+    return n;
+}
@@ -9,6 +9,14 @@ static int pyoneer_get_job_status(Pyoneer* pyoneer) {
     return worker_get_job_status(pyoneer->as.worker);
 }
 
+static int pyoneer_get_worker_version(Pyoneer* pyoneer) {
+    return worker_get_version(pyoneer->as.worker);
+}
+
+static json_value* pyoneer_get_worker_snapshot(Pyoneer* pyoneer) {
+    return worker_get_snapshot(pyoneer->as.worker);
+}
+
 static int pyoneer_run_job(Pyoneer* pyoneer, Blueprint* blueprint) {
     return worker_run(pyoneer->as.worker, blueprint->as.job);
 }
@@ -30,6 +38,9 @@ static int pyoneer_worker_stop(Pyoneer* pyoneer) {
 }
 
 /* pyoneer manager wrappers */
+static int pyoneer_get_manager_version(Pyoneer* pyoneer) {
+    return manager_get_version(pyoneer->as.manager);
+}
 
 /* pyoneer_create: Creates a new pyoneer. */
 Pyoneer* pyoneer_create(int id, int role) {
@@ -45,6 +56,8 @@ Pyoneer* pyoneer_create(int id, int role) {
             pyoneer->run = pyoneer_run_job;
             pyoneer->get_status = pyoneer_get_worker_status;
             pyoneer->get_blueprint_status = pyoneer_get_job_status;
+            pyoneer->get_version = pyoneer_get_worker_version;
+            pyoneer->get_snapshot = pyoneer_get_worker_snapshot;
             pyoneer->assign = pyoneer_assign_job;
             pyoneer->unassign = pyoneer_unassign_job;
             pyoneer->start = pyoneer_worker_start;
@@ -53,6 +66,8 @@ Pyoneer* pyoneer_create(int id, int role) {
         case PYONEER_MANAGER:
             pyoneer->role = PYONEER_MANAGER;
             pyoneer->as.manager = manager_create(id);
+            pyoneer->get_version = pyoneer_get_manager_version;
+            pyoneer->get_snapshot = NULL;
             // Add manager methods
             break;
     }
@@ -68,3 +68,15 @@ Task* task_decode(const json_value* obj) {
     if (name->type != json_string) return NULL;
     return task_create(name->u.string.ptr);
 }
+
+/* task_status_encode: Encodes the task status into a JSON value. */
+json_value* task_status_encode(int status) {
+    switch (status) {
+        case TASK_NOT_READY: return json_string_new("not_ready");
+        case TASK_READY: return json_string_new("ready");
+        case TASK_RUNNING: return json_string_new("running");
+        case TASK_COMPLETED: return json_string_new("completed");
+        case TASK_INCOMPLETE: return json_string_new("incomplete");
+    }
+    return json_null_new();
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// The kernel shares the ring indices with us
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* uring_enter: Calls io_uring_enter(2). */
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+    unsigned int flags, void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* uring_create: Creates a new io_uring instance with room for entries
+    submissions and cq_entries completions, and returns a pointer to it.
+    Otherwise, returns NULL. Fails if the kernel doesn't support a single
+    mmap of the rings or timeouts while waiting (Linux 5.11). */
+Uring* uring_create(unsigned int entries, unsigned int cq_entries) {
+    Uring* ring = malloc(sizeof(Uring));
+    if (ring == NULL) {
+        perror("uring_create: malloc");
+        return NULL;
+    }
+    memset(ring, 0, sizeof(Uring));
+
+    struct io_uring_params p = {0};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    ring->ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->ring_fd == -1) {
+        perror("uring_create: io_uring_setup");
+        free(ring);
+        return NULL;
+    }
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "uring_create: io_uring_setup: kernel is too old\n");
+        close(ring->ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    // The submission and completion rings share one mapping
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_len = (sq_len > cq_len) ? sq_len : cq_len;
+    ring->ring_ptr = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->ring_ptr == MAP_FAILED) {
+        perror("uring_create: mmap");
+        close(ring->ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("uring_create: mmap");
+        munmap(ring->ring_ptr, ring->ring_len);
+        close(ring->ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    char* ptr = ring->ring_ptr;
+    ring->sq_head = (unsigned int*)(ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned int*)(ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned int*)(ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(ptr + p.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int*)(ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned int*)(ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ptr + p.cq_off.cqes);
+    return ring;
+}
+
+/* uring_destroy: Closes the io_uring instance and frees its rings and
+    buffers. */
+void uring_destroy(Uring* ring) {
+    if (ring == NULL) return;
+    if (ring->br) munmap(ring->br, ring->br_len);
+    free(ring->bufs);
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->ring_ptr, ring->ring_len);
+    close(ring->ring_fd);
+    free(ring);
+}
+
+/* uring_get_sqe: Returns a zeroed submission queue entry. If the queue is
+    full, the pending entries are submitted first. Otherwise, returns NULL. */
+struct io_uring_sqe* uring_get_sqe(Uring* ring) {
+    unsigned int mask = *ring->sq_mask;
+    if (ring->sq_local_tail - load_acquire(ring->sq_head) > mask) {
+        if (uring_submit(ring, 0) == -1) return NULL;
+        if (ring->sq_local_tail - load_acquire(ring->sq_head) > mask)
+            return NULL;
+    }
+
+    unsigned int idx = ring->sq_local_tail & mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+/* uring_submit: Submits the pending entries. If timeout is not 0, waits up
+    to timeout ms (forever if negative) for a completion. Returns 0 on
+    success or timeout, and -1 otherwise with errno set. */
+int uring_submit(Uring* ring, int timeout) {
+    store_release(ring->sq_tail, ring->sq_local_tail);
+
+    unsigned int flags = 0;
+    unsigned int min_complete = 0;
+    struct io_uring_getevents_arg arg = {0};
+    struct __kernel_timespec ts = {0};
+    if (timeout != 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        min_complete = 1;
+        if (timeout > 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+            arg.ts = (unsigned long)&ts;
+        }
+    }
+
+    while (1) {
+        int rv = uring_enter(ring->ring_fd, ring->to_submit, min_complete,
+            flags, (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL, sizeof(arg));
+        if (rv >= 0) {
+            ring->to_submit -= rv;
+            return 0;
+        }
+        if (errno == ETIME) return 0;
+        if (errno == EINTR && ring->to_submit > 0) continue;
+        return -1;
+    }
+}
+
+/* uring_peek: Returns the next completion queue entry, or NULL if there is
+    none. */
+struct io_uring_cqe* uring_peek(Uring* ring) {
+    unsigned int head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail)) return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+/* uring_advance: Marks the entry returned by uring_peek as seen. */
+void uring_advance(Uring* ring) {
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+/* uring_buffers_create: Registers a ring of entries provided buffers of len
+    bytes each as buffer group bgid. Entries must be a power of two. Returns
+    0 on success, and -1 otherwise (Linux 5.19). */
+int uring_buffers_create(Uring* ring, unsigned short bgid,
+    unsigned int entries, size_t len) {
+    ring->br_len = entries * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->br == MAP_FAILED) {
+        perror("uring_buffers_create: mmap");
+        ring->br = NULL;
+        return -1;
+    }
+
+    ring->bufs = malloc(entries * len);
+    if (ring->bufs == NULL) {
+        perror("uring_buffers_create: malloc");
+        return -1;
+    }
+    ring->buf_entries = entries;
+    ring->buf_len = len;
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (unsigned long)ring->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, ring->ring_fd,
+        IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        perror("uring_buffers_create: io_uring_register");
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < entries; i++) {
+        struct io_uring_buf* buf = &ring->br->bufs[i];
+        buf->addr = (unsigned long)(ring->bufs + i * len);
+        buf->len = len;
+        buf->bid = i;
+    }
+    store_release(&ring->br->tail, entries);
+    return 0;
+}
+
+/* uring_buffer: Returns the provided buffer with the given id. */
+char* uring_buffer(Uring* ring, unsigned short bid) {
+    return ring->bufs + bid * ring->buf_len;
+}
+
+/* uring_buffer_return: Hands the provided buffer back to the kernel. */
+void uring_buffer_return(Uring* ring, unsigned short bid) {
+    unsigned short tail = ring->br->tail;
+    struct io_uring_buf* buf = &ring->br->bufs[tail & (ring->buf_entries - 1)];
+    buf->addr = (unsigned long)uring_buffer(ring, bid);
+    buf->len = ring->buf_len;
+    buf->bid = bid;
+    store_release(&ring->br->tail, tail + 1);
+}
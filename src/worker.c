@@ -3,9 +3,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include "worker.h"
+#include "json-builder.h"
 
 /* lock: Decrements the value of the semaphore and waits if its value
     is negative. If sem_waits fails, the system exits. */
@@ -27,6 +29,11 @@ static void unlock(sem_t *s, char *name) {
     return;
 }
 
+/* bump: Bumps the worker's state version, after a status change. */
+static void bump(Worker *worker) {
+    atomic_fetch_add_explicit(&worker->version, 1, memory_order_release);
+}
+
 /* create_running_job: Creates a new running job. */
 static RunningJob* create_running_job(Worker *worker) {
     RunningJob *rjob;
@@ -65,6 +72,9 @@ static void add(RunningJob *rjob, Task *task) {
         exit(EXIT_FAILURE);
     }
     node->task = task;
+    node->pid = 0;
+    node->start = 0;
+    node->rjob = rjob;
     node->next = rjob->head;
     rjob->head = node;
     return;
@@ -81,6 +91,7 @@ static void bind(RunningJob *rjob, Job *job) {
         curr = curr->next;
     }
     rjob->worker->status = WORKER_NOT_WORKING;
+    bump(rjob->worker);
     return;
 }
 
@@ -89,6 +100,7 @@ static void bind(RunningJob *rjob, Job *job) {
 static Job* unbind(RunningJob *rjob) {
     Job *job = rjob->job;
     rjob->worker->status = WORKER_NOT_ASSIGNED;
+    bump(rjob->worker);
     rjob->job = NULL;
     running_job_node *prev, *curr = rjob->head;
     while (curr->next) {
@@ -111,6 +123,7 @@ Worker* create_worker(int id) {
     worker->status = WORKER_NOT_ASSIGNED;
     worker->running_job = create_running_job(worker);
     sem_init(&worker->lock, 0, 1);
+    atomic_init(&worker->version, 0);
     return worker;
 }
 
@@ -154,11 +167,53 @@ int get_job_status(Worker *worker) {
     return status;
 }
 
+/* worker_get_version: Returns the worker's state version. The worker and
+    job statuses can only have changed if the version has. */
+unsigned int worker_get_version(Worker *worker) {
+    return atomic_load_explicit(&worker->version, memory_order_acquire);
+}
+
+/* worker_get_snapshot: Returns the worker's state as one JSON object: its
+    version, its status, and its job with each task's status, pid and start
+    time. The version comes first, so a client can skip an unchanged
+    snapshot without parsing it. */
+json_value* worker_get_snapshot(Worker *worker) {
+    lock(&worker->lock, "worker_get_snapshot");
+    json_value *obj = json_object_new(0);
+    json_object_push(obj, "version", json_integer_new(worker_get_version(worker)));
+    json_object_push(obj, "status", worker_status_encode(worker->status));
+    if (worker->status == WORKER_NOT_ASSIGNED) {
+        json_object_push(obj, "job", json_null_new());
+        unlock(&worker->lock, "worker_get_snapshot");
+        return obj;
+    }
+
+    Job *job = worker->running_job->job;
+    json_value *jobj = json_object_new(0);
+    json_value *tasks = json_array_new(0);
+    json_object_push(jobj, "id", json_integer_new(job->id));
+    json_object_push(jobj, "status", job_status_encode(job->status));
+    running_job_node *curr = worker->running_job->head;
+    while (curr) {
+        json_value *task = json_object_new(0);
+        json_object_push(task, "name", json_string_new(curr->task->name));
+        json_object_push(task, "status", task_status_encode(curr->task->status));
+        json_object_push(task, "pid", json_integer_new(curr->pid));
+        json_object_push(task, "start", json_integer_new(curr->start));
+        json_array_push(tasks, task);
+        curr = curr->next;
+    }
+    json_object_push(jobj, "tasks", tasks);
+    json_object_push(obj, "job", jobj);
+    unlock(&worker->lock, "worker_get_snapshot");
+    return obj;
+}
 
 /* task_status_handler: Sets the status of the task as incomplete. */
 static void task_status_handler(void *arg) {
-    job_node* task = (job_node*) arg;
-    task->status = TASK_INCOMPLETE;
+    running_job_node* node = (running_job_node*) arg;
+    node->task->status = TASK_INCOMPLETE;
+    bump(node->rjob->worker);
     return;
 }
 
@@ -182,7 +237,8 @@ static void task_process_handler(void *arg) {
 
 /* task_thread: Runs the task and changes the status of the task. */
 static void *task_thread(void *arg) {
-    job_node* task = (job_node*)arg;
+    running_job_node* node = (running_job_node*)arg;
+    Task* task = node->task;
     task->status = TASK_RUNNING;
 
     // run task
@@ -195,9 +251,15 @@ static void *task_thread(void *arg) {
     if (id == 0) run_task(task);
     
     // parent process
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    node->pid = id;
+    node->start = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    bump(node->rjob->worker);
+
     int rv;
-    pthread_cleanup_push(task_status_handler, task);
-    pthread_cleanup_push(task_process_handler, task);
+    pthread_cleanup_push(task_status_handler, node);
+    pthread_cleanup_push(task_process_handler, node);
     if (waitpid(id, &rv, 0) == -1) {
         perror("worker: task_thread: waitpid");
         exit(EXIT_FAILURE);
@@ -210,12 +272,14 @@ static void *task_thread(void *arg) {
         task->status = TASK_COMPLETED;
     else
         task->status = TASK_NOT_READY;
+    bump(node->rjob->worker);
     return NULL;
 }
 
 /* job_status_handler: Updates the job status. */
 static void job_status_handler(void* arg) {
-    Job* job = (Job*)arg;
+    RunningJob* rjob = (RunningJob*)arg;
+    Job* job = rjob->job;
     int status = JOB_INCOMPLETE;
     job_node* curr = job->head;
     while (curr) {
@@ -226,6 +290,7 @@ static void job_status_handler(void* arg) {
         curr = curr->next;
     }
     job->status = status;
+    bump(rjob->worker);
     return;
 }
 
@@ -247,6 +312,7 @@ static void* job_thread(void* args) {
 
     // set job status
     rjob->job->status = JOB_RUNNING;
+    bump(rjob->worker);
 
     // create task threads
     int old_errno;
@@ -258,7 +324,7 @@ static void* job_thread(void* args) {
                 continue;
             case TASK_READY:
                 old_errno = pthread_create(&curr->tid, NULL,
-                    task_thread, curr->task);
+                    task_thread, curr);
                     break;
             case TASK_RUNNING:
                 fprintf(stderr, "worker: job_thread: error: inconsistent task status\n");
@@ -268,7 +334,7 @@ static void* job_thread(void* args) {
                 continue;
             case TASK_INCOMPLETE:
                 old_errno = pthread_create(&curr->tid, NULL,
-                    task_thread, curr->task);
+                    task_thread, curr);
                 break;
         }
         if (old_errno != 0) {
@@ -281,7 +347,7 @@ static void* job_thread(void* args) {
 
     // join all task threads
     curr = rjob->head;
-    pthread_cleanup_push(job_status_handler, rjob->job);
+    pthread_cleanup_push(job_status_handler, rjob);
     pthread_cleanup_push(task_thread_handler, rjob);
     while (curr) {
         switch (curr->task->status) {
@@ -337,6 +403,7 @@ static void* job_thread(void* args) {
     }
     rjob->job->status = status;
     rjob->worker->status = WORKER_NOT_WORKING;
+    bump(rjob->worker);
     return NULL;
 }
 
@@ -362,6 +429,7 @@ int run(Worker *worker, Job *job) {
         exit(EXIT_FAILURE);
     }
     worker->status = WORKER_WORKING;
+    bump(worker);
     unlock(&worker->lock, "run");
     return 0;
 }
@@ -406,6 +474,7 @@ int start(Worker *worker) {
         exit(EXIT_FAILURE);
     }
     worker->status = WORKER_WORKING;
+    bump(worker);
     return get_job_status(worker);
 }
 
@@ -428,6 +497,7 @@ int worker_stop(Worker *worker) {
         exit(EXIT_FAILURE);
     }
     worker->status = WORKER_NOT_WORKING;
+    bump(worker);
     return get_job_status(worker);
 }
 
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "net.h"
+
+#define NCONNS 20000
+#define NCLIENTS 8
+#define MAXLISTENERS 8
+
+// Listener thread, accepts and closes connections like an idle api loop
+struct listener {
+    int fd;
+    pthread_t tid;
+};
+
+static atomic_int accepted;
+static atomic_int halt;
+static net_addr target;
+
+/* listener_thread: Accepts connections on the listener's socket until the
+    benchmark halts. */
+static void* listener_thread(void* arg) {
+    struct listener* l = arg;
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, l->fd, &ev);
+
+    while (atomic_load(&halt) == 0) {
+        if (epoll_wait(epfd, &ev, 1, 10) <= 0) continue;
+        int fd;
+        while ((fd = accept(l->fd, NULL, NULL)) != -1) {
+            close(fd);
+            atomic_fetch_add(&accepted, 1);
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+/* client_thread: Opens and resets its share of the connections. */
+static void* client_thread(void* arg) {
+    (void)arg;
+    struct linger reset = {1, 0};
+    for (int i = 0; i < NCONNS / NCLIENTS; i++) {
+        int fd = net_connect(&target);
+        if (fd == -1) exit(EXIT_FAILURE);
+
+        // Reset instead of closing, so client ports don't pile up in TIME_WAIT
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(fd);
+    }
+    return NULL;
+}
+
+/* run: Opens NCONNS connections from NCLIENTS threads and returns the number
+    of connections per second, once all of them were accepted. If expect is
+    0, the server isn't ours and only the connects are timed. */
+static double run(int expect) {
+    pthread_t clients[NCLIENTS];
+    struct timespec start, end;
+    atomic_store(&accepted, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < NCLIENTS; i++)
+        pthread_create(&clients[i], NULL, client_thread, NULL);
+    for (int i = 0; i < NCLIENTS; i++)
+        pthread_join(clients[i], NULL);
+    while (expect && atomic_load(&accepted) < expect)
+        sched_yield();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return (NCONNS / NCLIENTS * NCLIENTS) / s;
+}
+
+/* bench_listeners: Runs the benchmark against n SO_REUSEPORT listeners on
+    a loopback port. */
+static void bench_listeners(int n) {
+    struct listener listeners[MAXLISTENERS];
+    char addr[64] = "127.0.0.1:0";
+    for (int i = 0; i < n; i++) {
+        listeners[i].fd = net_listen_tcp(addr, SOMAXCONN, 1);
+        if (listeners[i].fd == -1) exit(EXIT_FAILURE);
+
+        // The first socket picks the port the others share
+        if (i == 0) {
+            struct sockaddr_in sin;
+            socklen_t len = sizeof(sin);
+            getsockname(listeners[0].fd, (struct sockaddr*)&sin, &len);
+            snprintf(addr, sizeof(addr), "127.0.0.1:%d", ntohs(sin.sin_port));
+            if (net_addr_tcp(&target, addr) == -1) exit(EXIT_FAILURE);
+        }
+    }
+
+    atomic_store(&halt, 0);
+    for (int i = 0; i < n; i++)
+        pthread_create(&listeners[i].tid, NULL, listener_thread, &listeners[i]);
+
+    printf("%d listener(s): %8.0f connections/s\n", n, run(NCONNS / NCLIENTS * NCLIENTS));
+
+    atomic_store(&halt, 1);
+    for (int i = 0; i < n; i++) {
+        pthread_join(listeners[i].tid, NULL);
+        close(listeners[i].fd);
+    }
+}
+
+/* main: Benchmarks accept throughput with 1, 2, 4 and 8 listener threads
+    on loopback. Given a "host:port", benchmarks that server instead, for
+    example an api server started with PYONEER_API_LISTENERS. */
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        if (net_addr_tcp(&target, argv[1]) == -1) exit(EXIT_FAILURE);
+        printf("%s: %8.0f connections/s\n", argv[1], run(0));
+        exit(EXIT_SUCCESS);
+    }
+
+    for (int n = 1; n <= MAXLISTENERS; n *= 2)
+        bench_listeners(n);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "json-builder.h"
+#include "json-helpers.h"
+
+#define NREQUESTS 200000
+#define ARENALEN (64*1024)
+
+static const char* REQUEST =
+    "{\"command\":\"batch\",\"commands\":["
+    "{\"command\":\"get_status\"},"
+    "{\"command\":\"get_blueprint_status\"},"
+    "{\"command\":\"run\",\"job\":{\"id\":42,\"tasks\":"
+    "[\"task1\",\"task2\",\"task3\",\"task4\",\"task5\",\"task6\"]}}]}";
+
+/* handle: Parses the request, builds a response like the api server's
+    batch response and serializes it into out. Returns the response length,
+    or -1 on failure. */
+static int handle(Arena* arena, const char* req, char* out) {
+    json_settings settings = {0};
+    settings.value_extra = json_builder_extra;
+    if (arena) {
+        settings.mem_alloc = arena_mem_alloc;
+        settings.mem_free = arena_mem_free;
+        settings.user_data = arena;
+    }
+
+    char error[json_error_max];
+    json_value* val = json_parse_ex(&settings, req, strlen(req), error);
+    if (val == NULL) return -1;
+
+    json_value* cmds = json_object_get_value(val, "commands");
+    json_value* results = json_array_new(0);
+    for (unsigned int i = 0; i < cmds->u.array.length; i++) {
+        json_value* res = json_object_new(0);
+        json_object_push(res, "status", json_string_new("working"));
+        json_object_push(res, "job_id", json_integer_new(i));
+        json_array_push(results, res);
+    }
+    json_value* resp = json_object_new(0);
+    json_object_push(resp, "results", results);
+
+    json_serialize(out, resp);
+    int len = strlen(out);
+
+    if (arena) {
+        arena_reset(arena);
+    } else {
+        json_value_free(val);
+        json_builder_free(resp);
+    }
+    return len;
+}
+
+/* run: Handles NREQUESTS requests and returns the average number of
+    nanoseconds per request. */
+static double run(Arena* arena) {
+    char out[1024];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < NREQUESTS; i++) {
+        if (handle(arena, REQUEST, out) == -1) {
+            fprintf(stderr, "run: Error: Failed to handle request\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return ns / NREQUESTS;
+}
+
+int main() {
+    printf("malloc: %8.1f ns/request\n", run(NULL));
+
+    Arena* arena = arena_create(ARENALEN);
+    if (arena == NULL) exit(EXIT_FAILURE);
+
+    json_builder_settings settings = {0};
+    settings.mem_alloc = arena_mem_alloc;
+    settings.mem_realloc = arena_mem_realloc;
+    settings.mem_free = arena_mem_free;
+    settings.user_data = arena;
+    json_builder_set_settings(&settings);
+
+    printf("arena:  %8.1f ns/request\n", run(arena));
+
+    json_builder_set_settings(NULL);
+    arena_destroy(arena);
+    exit(EXIT_SUCCESS);
+}
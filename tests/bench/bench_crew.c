@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "idmap.h"
+
+#define NWORKERS 100000
+#define NLOOKUPS 1000000
+#define NSCANS 100
+#define NBUCKETS 512    // the crew's old bucket count
+#define NFINDS 100000
+#define NCLASSES 4
+#define IDLE_PERCENT 1
+
+// Old crew layout, a separately allocated node and worker per id in one of
+// NBUCKETS doubly linked lists
+struct list_worker {
+    int id;
+    int status;
+    int job_id;
+    int job_status;
+};
+
+struct list_node {
+    struct list_worker* worker;
+    struct list_node* next;
+    struct list_node* prev;
+};
+
+struct list_crew {
+    struct list_node* heads[NBUCKETS];
+};
+
+// New crew layout, an id index over dense arrays
+struct flat_crew {
+    IdMap* index;
+    int* ids;
+    int* status;
+    int* job_ids;
+    int* job_status;
+};
+
+static volatile long sink;
+
+/* now: Returns the monotonic clock in seconds. */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* list_find: Finds the node of the id, walking its bucket like in_crew
+    followed by get_crew_node did. */
+static struct list_node* list_find(struct list_crew* crew, int id) {
+    struct list_node* curr;
+    for (curr = crew->heads[id % NBUCKETS]; curr; curr = curr->next)
+        if (curr->worker->id == id)
+            break;
+    if (curr == NULL)
+        return NULL;
+    for (curr = crew->heads[id % NBUCKETS]; curr; curr = curr->next)
+        if (curr->worker->id == id)
+            return curr;
+    return NULL;
+}
+
+/* bench_list: Times lookups and full scans of the old layout. */
+static void bench_list(const int* ids, const int* keys) {
+    struct list_crew crew = {0};
+    double start = now();
+    for (int i = 0; i < NWORKERS; i++) {
+        struct list_node* node = malloc(sizeof(struct list_node));
+        node->worker = malloc(sizeof(struct list_worker));
+        node->worker->id = ids[i];
+        node->worker->status = i % 3;
+        node->worker->job_id = -1;
+        node->worker->job_status = -1;
+        node->prev = NULL;
+        node->next = crew.heads[ids[i] % NBUCKETS];
+        if (node->next)
+            node->next->prev = node;
+        crew.heads[ids[i] % NBUCKETS] = node;
+    }
+    double add = now() - start;
+
+    start = now();
+    long sum = 0;
+    for (int i = 0; i < NLOOKUPS; i++)
+        sum += list_find(&crew, keys[i])->worker->status;
+    double lookup = now() - start;
+
+    start = now();
+    for (int s = 0; s < NSCANS; s++)
+        for (int b = 0; b < NBUCKETS; b++)
+            for (struct list_node* curr = crew.heads[b]; curr; curr = curr->next)
+                sum += curr->worker->status == 2;
+    double scan = now() - start;
+    sink = sum;
+
+    printf("bucket lists: add %7.1f ms, lookup %7.1f ns, scan %7.3f ms\n",
+        add * 1e3, lookup / NLOOKUPS * 1e9, scan / NSCANS * 1e3);
+
+    for (int b = 0; b < NBUCKETS; b++) {
+        struct list_node* curr = crew.heads[b];
+        while (curr) {
+            struct list_node* next = curr->next;
+            free(curr->worker);
+            free(curr);
+            curr = next;
+        }
+    }
+}
+
+/* bench_flat: Times lookups and full scans of the new layout. */
+static void bench_flat(const int* ids, const int* keys) {
+    struct flat_crew crew;
+    double start = now();
+    crew.index = idmap_create(0);
+    crew.ids = malloc(NWORKERS * sizeof(int));
+    crew.status = malloc(NWORKERS * sizeof(int));
+    crew.job_ids = malloc(NWORKERS * sizeof(int));
+    crew.job_status = malloc(NWORKERS * sizeof(int));
+    for (int i = 0; i < NWORKERS; i++) {
+        idmap_put(crew.index, ids[i], i);
+        crew.ids[i] = ids[i];
+        crew.status[i] = i % 3;
+        crew.job_ids[i] = -1;
+        crew.job_status[i] = -1;
+    }
+    double add = now() - start;
+
+    start = now();
+    long sum = 0;
+    for (int i = 0; i < NLOOKUPS; i++)
+        sum += crew.status[idmap_get(crew.index, keys[i])];
+    double lookup = now() - start;
+
+    start = now();
+    for (int s = 0; s < NSCANS; s++)
+        for (int i = 0; i < NWORKERS; i++)
+            sum += crew.status[i] == 2;
+    double scan = now() - start;
+    sink = sum;
+
+    printf("flat index:   add %7.1f ms, lookup %7.1f ns, scan %7.3f ms\n",
+        add * 1e3, lookup / NLOOKUPS * 1e9, scan / NSCANS * 1e3);
+
+    idmap_destroy(crew.index);
+    free(crew.ids);
+    free(crew.status);
+    free(crew.job_ids);
+    free(crew.job_status);
+}
+
+/* bench_idle: Times finding an idle worker of a class, and counting the
+    idle workers of a class, with a freelist walked for a match and with
+    idle and class bitsets. Each worker found is made idle again, so every
+    search sees the same crew. */
+static void bench_idle(void) {
+    int words = (NWORKERS + 63) / 64;
+    int* classes = malloc(NWORKERS * sizeof(int));
+    int* next = malloc(NWORKERS * sizeof(int));
+    int* prev = malloc(NWORKERS * sizeof(int));
+    uint64_t* idle = calloc(words, sizeof(uint64_t));
+    uint64_t* members = calloc(NCLASSES * words, sizeof(uint64_t));
+    if (!classes || !next || !prev || !idle || !members)
+        exit(EXIT_FAILURE);
+
+    // Freelist of the idle workers, in random order like an old crew
+    int head = -1, tail = -1, nidle = 0;
+    for (int i = 0; i < NWORKERS; i++) {
+        classes[i] = rand() % NCLASSES;
+        members[classes[i] * words + i / 64] |= (uint64_t)1 << (i % 64);
+        if (rand() % 100 >= IDLE_PERCENT)
+            continue;
+        idle[i / 64] |= (uint64_t)1 << (i % 64);
+        nidle++;
+        next[i] = head;
+        prev[i] = -1;
+        if (head == -1)
+            tail = i;
+        else
+            prev[head] = i;
+        head = i;
+    }
+
+    double start = now();
+    long sum = 0;
+    for (int f = 0; f < NFINDS; f++) {
+        int c = f % NCLASSES, i = head;
+        while (i != -1 && classes[i] != c)
+            i = next[i];
+        if (i == -1 || i == tail)
+            continue;
+
+        // Unlink and append, like an assign followed by an unassign
+        if (prev[i] == -1)
+            head = next[i];
+        else
+            next[prev[i]] = next[i];
+        prev[next[i]] = prev[i];
+        next[tail] = i;
+        prev[i] = tail;
+        next[i] = -1;
+        tail = i;
+        sum += i;
+    }
+    double list_find = now() - start;
+
+    // Searches go round the crew from the last word a worker was found in,
+    // like the crew's cursor
+    start = now();
+    int cursor = 0;
+    for (int f = 0; f < NFINDS; f++) {
+        uint64_t* set = members + (f % NCLASSES) * words;
+        for (int n = 0; n < words; n++) {
+            int w = (cursor + n) % words;
+            uint64_t bits = idle[w] & set[w];
+            if (bits) {
+                int i = w * 64 + __builtin_ctzll(bits);
+                idle[w] &= ~((uint64_t)1 << (i % 64));
+                idle[w] |= (uint64_t)1 << (i % 64);
+                cursor = (w + 1) % words;
+                sum += i;
+                break;
+            }
+        }
+    }
+    double bits_find = now() - start;
+
+    start = now();
+    for (int f = 0; f < NFINDS / 100; f++) {
+        int c = f % NCLASSES;
+        for (int i = head; i != -1; i = next[i])
+            sum += classes[i] == c;
+    }
+    double list_count = now() - start;
+
+    start = now();
+    for (int f = 0; f < NFINDS / 100; f++) {
+        uint64_t* set = members + (f % NCLASSES) * words;
+        for (int w = 0; w < words; w++)
+            sum += __builtin_popcountll(idle[w] & set[w]);
+    }
+    double bits_count = now() - start;
+    sink = sum;
+
+    printf("%d idle workers in %d classes\n", nidle, NCLASSES);
+    printf("freelist:     find %7.1f ns, count %7.1f us\n",
+        list_find / NFINDS * 1e9, list_count / (NFINDS / 100) * 1e6);
+    printf("bitsets:      find %7.1f ns, count %7.1f us\n",
+        bits_find / NFINDS * 1e9, bits_count / (NFINDS / 100) * 1e6);
+
+    free(classes);
+    free(next);
+    free(prev);
+    free(idle);
+    free(members);
+}
+
+/* main: Benchmarks adding NWORKERS workers to the old and new crew
+    layouts, looking up random workers by id, and scanning every worker's
+    status. Workers are added in random order, like workers joining over
+    time. Then benchmarks finding idle workers of a class. */
+int main(void) {
+    int* ids = malloc(NWORKERS * sizeof(int));
+    int* keys = malloc(NLOOKUPS * sizeof(int));
+    if (ids == NULL || keys == NULL)
+        exit(EXIT_FAILURE);
+
+    srand(1);
+    for (int i = 0; i < NWORKERS; i++)
+        ids[i] = i;
+    for (int i = NWORKERS - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int tmp = ids[i];
+        ids[i] = ids[j];
+        ids[j] = tmp;
+    }
+    for (int i = 0; i < NLOOKUPS; i++)
+        keys[i] = rand() % NWORKERS;
+
+    printf("%d workers\n", NWORKERS);
+    bench_list(ids, keys);
+    bench_flat(ids, keys);
+    bench_idle();
+
+    free(ids);
+    free(keys);
+    exit(EXIT_SUCCESS);
+}
@@ -1,13 +1,42 @@
+#include <poll.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include "crew.h"
+#include "frame.h"
 #include "unittest.h"
 
 #define success unittest_success
 #define failure unittest_failure
 #define printr(result, name, msg) unittest_print_result("test-crew", result, name, msg)
 
+#define NWORKERS 200    // more than CREW_MINCAP, so the arrays grow
+#define FAKE_CONNS 4
+
+// fake worker, answering the crew on its local socket until stopped
+typedef struct {
+    int id;
+    int listen_fd;
+    int conns[FAKE_CONNS];
+    int working;
+    atomic_int running;
+    pthread_t tid;
+} fake_worker;
+
 bool check_table(Crew *);
+json_value *new_job(int);
+int fake_start(fake_worker *, int);
+void fake_stop(fake_worker *);
+void test_index(void);
+void test_idle(void);
+void test_failure(void);
+void test_restart(void);
 
 
 int main() {
@@ -27,7 +56,7 @@ int main() {
     if (check_table(crew) == true)
         printr(success, "empty crew table check", NULL);
     else
-        printr(failure, "empty crew table check", "inconsistent list length");
+        printr(failure, "empty crew table check", "inconsistent index");
 
     // add worker
     add_worker(crew, 3);
@@ -76,13 +105,343 @@ int main() {
     sleep(10);
     
     free_crew(crew);
+
+    test_index();
+    test_idle();
+    test_failure();
+    test_restart();
     return 0;
 }
 
-// check_table: Checks the lengths of all the lists in the table.
+// test_index: Checks that the index follows workers moved to fill the
+// indices of removed workers.
+void test_index(void) {
+    Crew *crew = create_crew();
+    bool ok;
+
+    for (int id = 0; id < NWORKERS; id++)
+        add_worker(crew, 7 * id);
+
+    if (crew->len == NWORKERS && check_table(crew) == true)
+        printr(success, "index add workers", NULL);
+    else
+        printr(failure, "index add workers", "inconsistent index");
+
+    // remove every other worker from the front, each filled by the last
+    for (int id = 0; id < NWORKERS; id += 2)
+        remove_worker(crew, 7 * id);
+
+    ok = crew->len == NWORKERS / 2 && check_table(crew);
+    for (int id = 0; id < NWORKERS && ok; id++)
+        ok = get_worker_status(crew, 7 * id) == (id % 2 ? worker_not_assigned : -1);
+    if (ok)
+        printr(success, "index remove workers", NULL);
+    else
+        printr(failure, "index remove workers", "inconsistent index after removals");
+
+    // add the removed workers again
+    for (int id = 0; id < NWORKERS; id += 2)
+        add_worker(crew, 7 * id);
+
+    if (crew->len == NWORKERS && check_table(crew) == true)
+        printr(success, "index add removed workers", NULL);
+    else
+        printr(failure, "index add removed workers", "inconsistent index");
+
+    free_crew(crew);
+}
+
+// test_idle: Checks the idle and class bitsets as a worker is assigned, is
+// moved to another index, and is unassigned. Workers 2 and 3 can't be
+// reached, and are checked before they become suspect.
+void test_idle(void) {
+    Crew *crew = create_crew();
+    fake_worker fake;
+    json_value *job = new_job(1);
+
+    fake_start(&fake, 1);
+    add_worker(crew, 2);
+    add_worker(crew, 3);
+    add_worker(crew, 1);
+    crew_set_classes(crew, 2, 1u << 0);
+    crew_set_classes(crew, 3, 1u << 0 | 1u << 1);
+    crew_set_classes(crew, 1, 1u << 2);
+
+    if (crew_idle_count(crew, 0) == 3 && crew_idle_count(crew, 1u << 0) == 2 &&
+        crew_idle_count(crew, 1u << 0 | 1u << 1) == 1 && crew_idle_count(crew, 1u << 2) == 1)
+        printr(success, "idle count", NULL);
+    else
+        printr(failure, "idle count", "unexpected idle count");
+
+    // a worker that can't be reached stays idle
+    if (crew_assign_class(crew, job, 1u << 1) == -1 && crew_idle_count(crew, 1u << 1) == 1)
+        printr(success, "unreachable worker idle", NULL);
+    else
+        printr(failure, "unreachable worker idle", "worker left the idle set");
+
+    // the assigned worker leaves the idle set
+    if (crew_assign_class(crew, job, 1u << 2) == 1 && get_worker_status(crew, 1) == worker_working &&
+        crew_idle_count(crew, 0) == 2 && crew_idle_count(crew, 1u << 2) == 0)
+        printr(success, "assigned worker working", NULL);
+    else
+        printr(failure, "assigned worker working", "worker still idle");
+
+    // removing worker 2 moves worker 1 to its index, with its bits
+    remove_worker(crew, 2);
+
+    if (check_table(crew) == true && get_worker_status(crew, 1) == worker_working &&
+        crew_idle_count(crew, 0) == 1 && crew_idle_count(crew, 1u << 0) == 1 &&
+        crew_idle_count(crew, 1u << 2) == 0)
+        printr(success, "moved worker bits", NULL);
+    else
+        printr(failure, "moved worker bits", "bits left at the old index");
+
+    // the unassigned worker is idle again, at its new index
+    unassign_worker(crew, 1);
+
+    if (get_worker_status(crew, 1) == worker_not_assigned && crew_idle_count(crew, 0) == 2 &&
+        crew_idle_count(crew, 1u << 2) == 1)
+        printr(success, "unassigned worker idle", NULL);
+    else
+        printr(failure, "unassigned worker idle", "worker not idle");
+
+    json_builder_free(job);
+    free_crew(crew);
+    fake_stop(&fake);
+}
+
+// test_failure: Checks that a worker that stops answering becomes suspect,
+// then dead once its phi passes the threshold, and that its job is handed
+// back. The worker is alive again once it answers.
+void test_failure(void) {
+    Crew *crew = create_crew();
+    fake_worker fake;
+    json_value *job = new_job(1);
+    struct timespec start, end;
+    int health, *job_ids, n;
+    bool suspect = false;
+    long ms;
+
+    fake_start(&fake, 7);
+    add_worker(crew, 7);
+    sleep(1);
+
+    if (assign_job(crew, job) == 7 && get_worker_status(crew, 7) == worker_working)
+        printr(success, "failure assign job", NULL);
+    else
+        printr(failure, "failure assign job", "failed to assign job");
+
+    // a worker that answers stays alive
+    sleep(5);
+
+    if (crew_get_health(crew, 7) == CREW_ALIVE)
+        printr(success, "answering worker alive", NULL);
+    else
+        printr(failure, "answering worker alive", "worker suspected");
+
+    // stop answering, and follow the worker's health until it is dead
+    fake_stop(&fake);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 100; i++) {
+        usleep(100000);
+        if ((health = crew_get_health(crew, 7)) == CREW_DEAD)
+            break;
+        if (health == CREW_SUSPECT)
+            suspect = true;
+        else if (suspect == true)
+            break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    if (suspect == true)
+        printr(success, "silent worker suspect", NULL);
+    else
+        printr(failure, "silent worker suspect", "worker never suspected");
+
+    if (health == CREW_DEAD && ms > CREW_PHI_PAUSE)
+        printr(success, "silent worker dead", NULL);
+    else
+        printr(failure, "silent worker dead", "worker not declared dead past the threshold");
+
+    // the dead worker's job is handed back, and it gets no new jobs
+    n = crew_take_orphans(crew, &job_ids);
+
+    if (n == 1 && job_ids[0] == 1 && get_worker_status(crew, 7) == worker_not_assigned &&
+        crew_idle_count(crew, 0) == 0)
+        printr(success, "dead worker job orphaned", NULL);
+    else
+        printr(failure, "dead worker job orphaned", "job not handed back");
+    free(job_ids);
+
+    // the worker answers again
+    fake_start(&fake, 7);
+    sleep(3);
+
+    if (crew_get_health(crew, 7) == CREW_ALIVE && crew_idle_count(crew, 0) == 1)
+        printr(success, "dead worker alive", NULL);
+    else
+        printr(failure, "dead worker alive", "worker still dead");
+
+    json_builder_free(job);
+    free_crew(crew);
+    fake_stop(&fake);
+}
+
+// check_table: Checks that the index maps each worker id to its position
+// in the arrays.
 bool check_table(Crew *crew) {
-    int len = 0;
-    for (int i = 0; i < _CREW_MAXLEN; i++)
-        len += crew->workers[i].len;
-    return (crew->len == len);
+    if ((int)crew->index->len != crew->len)
+        return false;
+    for (int i = 0; i < crew->len; i++)
+        if (idmap_get(crew->index, crew->ids[i]) != i)
+            return false;
+    return true;
+}
+
+// test_restart: Checks that a worker that restarts without being declared
+// dead, and answers that it is unassigned, is idle again and its job is
+// handed back.
+void test_restart(void) {
+    Crew *crew = create_crew();
+    fake_worker fake;
+    json_value *job = new_job(2);
+    int *job_ids, n;
+
+    fake_start(&fake, 8);
+    add_worker(crew, 8);
+    sleep(1);
+
+    if (assign_job(crew, job) == 8 && crew_idle_count(crew, 0) == 0)
+        printr(success, "restart assign job", NULL);
+    else
+        printr(failure, "restart assign job", "failed to assign job");
+
+    // restart past the assign grace, the crew reconnects within a second
+    sleep(2);
+    fake_stop(&fake);
+    fake_start(&fake, 8);
+    sleep(3);
+
+    if (get_worker_status(crew, 8) == worker_not_assigned && crew_get_health(crew, 8) == CREW_ALIVE &&
+        crew_idle_count(crew, 0) == 1)
+        printr(success, "restarted worker idle", NULL);
+    else
+        printr(failure, "restarted worker idle", "worker left out of the idle set");
+
+    n = crew_take_orphans(crew, &job_ids);
+
+    if (n == 1 && job_ids[0] == 2)
+        printr(success, "restarted worker job orphaned", NULL);
+    else
+        printr(failure, "restarted worker job orphaned", "job not handed back");
+    free(job_ids);
+
+    json_builder_free(job);
+    free_crew(crew);
+    fake_stop(&fake);
+}
+
+// new_job: Creates a job without tasks.
+json_value *new_job(int id) {
+    json_value *job = json_object_new(0);
+    json_object_push(job, "id", json_integer_new(id));
+    json_object_push(job, "tasks", json_array_new(0));
+    return job;
+}
+
+// fake_answer: Returns the fake worker's response to the request.
+const char *fake_answer(fake_worker *fake, const char *req) {
+    if (strstr(req, "\"run_job\"")) {
+        fake->working = 1;
+        return "{\"job_status\":\"running\"}";
+    }
+    if (strstr(req, "\"stop\"")) {
+        fake->working = 0;
+        return "{\"job_status\":\"incomplete\"}";
+    }
+    if (strstr(req, "\"get_snapshot\""))
+        return fake->working ? "{\"snapshot\":{\"status\":\"working\"}}" :
+            "{\"snapshot\":{\"status\":\"not_assigned\"}}";
+    return fake->working ? "{\"status\":\"working\"}" : "{\"status\":\"not_assigned\"}";
+}
+
+// fake_serve: Accepts the crew's connections and answers each request.
+void *fake_serve(void *arg) {
+    fake_worker *fake = arg;
+    struct pollfd fds[FAKE_CONNS + 1];
+    while (atomic_load(&fake->running)) {
+        fds[0].fd = fake->listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < FAKE_CONNS; i++) {
+            fds[i + 1].fd = fake->conns[i];
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, FAKE_CONNS + 1, 100) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(fake->listen_fd, NULL, NULL);
+            for (int i = 0; i < FAKE_CONNS && fd != -1; i++)
+                if (fake->conns[i] == -1) {
+                    fake->conns[i] = fd;
+                    fd = -1;
+                }
+            if (fd != -1)
+                close(fd);
+        }
+
+        for (int i = 0; i < FAKE_CONNS; i++) {
+            if (fake->conns[i] == -1 || fds[i + 1].revents == 0)
+                continue;
+            size_t len;
+            char *req = frame_recv(fake->conns[i], &len);
+            const char *res = req ? fake_answer(fake, req) : NULL;
+            if (res == NULL || frame_send(fake->conns[i], res, strlen(res)) == -1) {
+                close(fake->conns[i]);
+                fake->conns[i] = -1;
+            }
+            free(req);
+        }
+    }
+    return NULL;
+}
+
+// fake_start: Starts a fake worker on the local socket of the id. Returns 0
+// on success, and -1 otherwise.
+int fake_start(fake_worker *fake, int id) {
+    char *dir = getenv("PYONEER_DIR");
+    struct sockaddr_un addr = {0};
+    if (dir == NULL)
+        return -1;
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/worker%d.sock", dir, id);
+    unlink(addr.sun_path);
+
+    fake->id = id;
+    fake->working = 0;
+    for (int i = 0; i < FAKE_CONNS; i++)
+        fake->conns[i] = -1;
+    if ((fake->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+        bind(fake->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fake->listen_fd, FAKE_CONNS) == -1) {
+        perror("test-crew: fake_start");
+        return -1;
+    }
+    atomic_init(&fake->running, 1);
+    return pthread_create(&fake->tid, NULL, fake_serve, fake) == 0 ? 0 : -1;
+}
+
+// fake_stop: Stops the fake worker, closing its connections and removing
+// its socket, like a crashed worker.
+void fake_stop(fake_worker *fake) {
+    char path[256];
+    atomic_store(&fake->running, 0);
+    pthread_join(fake->tid, NULL);
+    for (int i = 0; i < FAKE_CONNS; i++)
+        if (fake->conns[i] != -1)
+            close(fake->conns[i]);
+    close(fake->listen_fd);
+    snprintf(path, sizeof(path), "%s/worker%d.sock", getenv("PYONEER_DIR"), fake->id);
+    unlink(path);
 }
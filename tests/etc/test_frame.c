@@ -0,0 +1,130 @@
+#include <stdbool.h>
+#include <string.h>
+#include "buffer.h"
+#include "frame.h"
+#include "unittest.h"
+
+#define success unittest_success
+#define failure unittest_failure
+#define printr(result, name, msg) unittest_print_result("test-frame", result, name, msg)
+
+bool check_frame(const frame *, const char *, int);
+
+
+int main() {
+    Buffer *in, *out;
+    frame f;
+    const char *req = "{\"command\":\"get_status\",\"name\":\"a}b\"}";
+    const char *body = "{\"command\":\"run\"}";
+
+    in = buffer_create(0);
+    out = buffer_create(0);
+
+    // empty read
+    if (frame_next(in->data, in->len, &f) == 0)
+        printr(success, "empty read", NULL);
+    else
+        printr(failure, "empty read", "message in an empty read");
+
+    // unframed object split across reads, with a brace inside a string
+    buffer_append(in, req, 14);
+
+    if (frame_next(in->data, in->len, &f) == 0)
+        printr(success, "split object first read", NULL);
+    else
+        printr(failure, "split object first read", "partial object taken as a message");
+
+    buffer_append(in, req + 14, 20);
+
+    if (frame_next(in->data, in->len, &f) == 0)
+        printr(success, "split object string read", NULL);
+    else
+        printr(failure, "split object string read", "brace in a string closed the object");
+
+    buffer_append(in, req + 34, strlen(req) - 34);
+
+    if (frame_next(in->data, in->len, &f) == 1 && check_frame(&f, req, 0))
+        printr(success, "split object last read", NULL);
+    else
+        printr(failure, "split object last read", "unexpected message");
+    buffer_consume(in, f.size);
+
+    // frame with its header split across reads
+    frame_push(out, body, strlen(body));
+    buffer_append(in, out->data, 2);
+
+    if (frame_next(in->data, in->len, &f) == 0)
+        printr(success, "split header first read", NULL);
+    else
+        printr(failure, "split header first read", "partial header taken as a message");
+
+    buffer_append(in, out->data + 2, FRAME_HEADER_LEN);
+
+    if (frame_next(in->data, in->len, &f) == 0)
+        printr(success, "split header body read", NULL);
+    else
+        printr(failure, "split header body read", "partial body taken as a message");
+
+    buffer_append(in, out->data + 2 + FRAME_HEADER_LEN, out->len - 2 - FRAME_HEADER_LEN);
+
+    if (frame_next(in->data, in->len, &f) == 1 && check_frame(&f, body, 1) &&
+        f.size == in->len)
+        printr(success, "split header last read", NULL);
+    else
+        printr(failure, "split header last read", "unexpected message");
+    buffer_consume(in, f.size);
+
+    // two newline terminated objects in one read
+    const char *lines = "{\"command\":\"get_status\"}\n{\"command\":\"get_status\"}\r\n";
+    buffer_append(in, lines, strlen(lines));
+
+    if (frame_next(in->data, in->len, &f) == 1 && check_frame(&f, "{\"command\":\"get_status\"}", 0))
+        printr(success, "pipelined objects first", NULL);
+    else
+        printr(failure, "pipelined objects first", "unexpected message");
+    buffer_consume(in, f.size);
+
+    if (frame_next(in->data, in->len, &f) == 1 && check_frame(&f, "{\"command\":\"get_status\"}", 0) &&
+        f.size == in->len)
+        printr(success, "pipelined objects second", NULL);
+    else
+        printr(failure, "pipelined objects second", "whitespace read as a frame header");
+    buffer_consume(in, f.size);
+
+    // whitespace alone, and whitespace before the next object's read
+    buffer_append(in, " \n", 2);
+
+    if (frame_next(in->data, in->len, &f) == 0)
+        printr(success, "whitespace read", NULL);
+    else
+        printr(failure, "whitespace read", "whitespace taken as a message");
+
+    buffer_append(in, body, strlen(body));
+
+    if (frame_next(in->data, in->len, &f) == 1 && check_frame(&f, body, 0) && f.size == in->len)
+        printr(success, "whitespace before object", NULL);
+    else
+        printr(failure, "whitespace before object", "unexpected message");
+    buffer_consume(in, f.size);
+
+    // header over the maximum length
+    char hdr[FRAME_HEADER_LEN];
+    frame_header_encode(hdr, FRAME_MAXLEN + 1);
+    buffer_append(in, hdr, FRAME_HEADER_LEN);
+
+    if (frame_next(in->data, in->len, &f) == -1)
+        printr(success, "oversized header", NULL);
+    else
+        printr(failure, "oversized header", "accepted an oversized frame");
+
+    buffer_destroy(in);
+    buffer_destroy(out);
+    return 0;
+}
+
+// check_frame: Checks that the frame holds the body and is framed as
+// expected.
+bool check_frame(const frame *f, const char *body, int framed) {
+    return f->len == strlen(body) && memcmp(f->body, body, f->len) == 0 &&
+        f->framed == framed;
+}
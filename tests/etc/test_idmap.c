@@ -0,0 +1,122 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "idmap.h"
+#include "unittest.h"
+
+#define success unittest_success
+#define failure unittest_failure
+#define printr(result, name, msg) unittest_print_result("test-idmap", result, name, msg)
+
+#define NIDS 1000
+#define ID(i) ((i) * 3)   // ids of which many collide, so removals shift entries
+
+bool check_map(IdMap *, const bool *);
+
+
+int main() {
+    IdMap *map;
+    bool present[NIDS] = {false};
+    size_t capacity;
+
+    // create empty map
+    map = idmap_create(0);
+
+    if (map->len == 0 && idmap_get(map, 0) == -1)
+        printr(success, "empty map", NULL);
+    else
+        printr(failure, "empty map", "unexpected id");
+
+    // insert ids, growing the map several times
+    capacity = map->capacity;
+    for (int id = 0; id < NIDS; id++) {
+        idmap_put(map, ID(id), NIDS - id);
+        present[id] = true;
+    }
+
+    if (map->capacity > capacity && 2 * map->len <= map->capacity)
+        printr(success, "insert grow", NULL);
+    else
+        printr(failure, "insert grow", "map is more than half full");
+
+    if (check_map(map, present) == true)
+        printr(success, "insert lookup", NULL);
+    else
+        printr(failure, "insert lookup", "inconsistent map");
+
+    // replace an index
+    idmap_put(map, ID(42), 7);
+
+    if (idmap_get(map, ID(42)) == 7 && map->len == NIDS)
+        printr(success, "replace index", NULL);
+    else
+        printr(failure, "replace index", "unexpected index or length");
+
+    idmap_put(map, ID(42), NIDS - 42);
+
+    // reject negative ids
+    if (idmap_put(map, -1, 0) == -1 && map->len == NIDS)
+        printr(success, "negative id", NULL);
+    else
+        printr(failure, "negative id", "added a negative id");
+
+    // remove every third id, which shifts back the entries after each one
+    for (int id = 0; id < NIDS; id += 3) {
+        if (idmap_remove(map, ID(id)) != NIDS - id)
+            break;
+        present[id] = false;
+    }
+
+    if (check_map(map, present) == true)
+        printr(success, "remove lookup", NULL);
+    else
+        printr(failure, "remove lookup", "inconsistent map after removals");
+
+    // remove missing ids
+    if (idmap_remove(map, ID(0)) == -1 && idmap_remove(map, ID(NIDS)) == -1)
+        printr(success, "remove missing id", NULL);
+    else
+        printr(failure, "remove missing id", "removed a missing id");
+
+    // reinsert the removed ids into the freed slots
+    for (int id = 0; id < NIDS; id += 3) {
+        idmap_put(map, ID(id), NIDS - id);
+        present[id] = true;
+    }
+
+    if (check_map(map, present) == true)
+        printr(success, "reinsert lookup", NULL);
+    else
+        printr(failure, "reinsert lookup", "inconsistent map after reinserts");
+
+    // remove all ids, leaving every slot empty
+    for (int id = NIDS - 1; id >= 0; id--) {
+        idmap_remove(map, ID(id));
+        present[id] = false;
+    }
+
+    if (map->len == 0 && check_map(map, present) == true)
+        printr(success, "remove all", NULL);
+    else
+        printr(failure, "remove all", "slots left in use");
+
+    idmap_destroy(map);
+    return 0;
+}
+
+// check_map: Checks that exactly the present ids are found with their
+// indices, and that the only slots in use are theirs, so removals leave no
+// tombstones.
+bool check_map(IdMap *map, const bool *present) {
+    size_t len = 0;
+    for (int id = 0; id < NIDS; id++) {
+        int index = idmap_get(map, ID(id));
+        if (present[id] ? index != NIDS - id : index != -1)
+            return false;
+        len += present[id];
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < map->capacity; i++)
+        used += map->slots[i].id != -1;
+    return map->len == len && used == len;
+}
@@ -1,11 +1,11 @@
 import os
 import json
 import socket
+import struct
 import unittest
 
 # Define global constants
 WORKER = os.getenv('WORKER_SOCKET', '/home/jsoychak/pyoneer/run/worker3.socket')
-BUFFSIZE = 1024
 
 # Get worker and job status codes
 worker_states = ['not_assigned', 'working', 'not_working']
@@ -22,12 +22,21 @@ class SmallTest(unittest.TestCase):
     def tearDown(self):
         self.sock.close()
 
-    def send_commnad(self, command, buffsize=BUFFSIZE):
+    def recv_exact(self, n):
+        ''' Receives exactly n bytes from the worker. '''
+        data = b''
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            self.assertTrue(chunk, 'connection closed by worker')
+            data += chunk
+        return data
+
+    def send_commnad(self, command):
         ''' Sends the command to the worker and returns its response. '''
-        obj = json.dumps(command)
-        self.sock.send(obj.encode())
-        data = self.sock.recv(buffsize)
-        return json.loads(data)
+        body = json.dumps(command).encode()
+        self.sock.sendall(struct.pack('!I', len(body)) + body)
+        n, = struct.unpack('!I', self.recv_exact(4))
+        return json.loads(self.recv_exact(n))
 
     def test_run_job(self):
         # Send command